@@ -0,0 +1,123 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdint.h>
+
+struct emulator;
+
+/* block table entry exported by a compiled ROM */
+typedef struct {
+    uint16_t    start;                  // first address of the block
+    uint16_t    end;                    // one past the last byte the block depends on
+    uint16_t    length;                 // number of instructions in the block
+    void        (*run)(uint8_t *chip8); // native code for the block
+} aotBlock;
+
+/* a loaded ahead-of-time compiled ROM */
+typedef struct aot aot;
+
+/*
+ * Get the path a compiled ROM is cached under.
+ * The cache lives in $XDG_CACHE_HOME/teal8 or ~/.cache/teal8
+ * and is keyed by the SHA1 hash of the ROM.
+ *
+ * Parameter:
+ * the SHA1 hash of the ROM
+ *
+ * Return:
+ * the path to the shared object (must be freed by caller),
+ * NULL if no cache directory could be created
+ */
+char *
+getAotCachePath(const char *hash);
+
+/*
+ * Compile the reachable code of a ROM into a shared object.
+ * Walks the code from 0x200, emits C with one function per basic block
+ * and builds it with the system compiler.
+ * The shared object appears at the path only once it is complete.
+ *
+ * Parameters:
+ * the emulator with the ROM written to memory,
+ * the path of the shared object to write
+ *
+ * Return:
+ * 0 on success,
+ * -1 on failure
+ */
+int
+compileAot(const struct emulator *chip8, const char *output);
+
+/*
+ * Load a compiled ROM.
+ * Shared objects built against a different emulator layout are rejected.
+ *
+ * Parameter:
+ * the path to the shared object
+ *
+ * Return:
+ * the loaded ROM,
+ * NULL on failure
+ */
+aot *
+loadAot(const char *path);
+
+/*
+ * Load the cached compiled ROM, compiling it first if needed.
+ *
+ * Parameters:
+ * the emulator with the ROM written to memory,
+ * the SHA1 hash of the ROM
+ *
+ * Return:
+ * the loaded ROM,
+ * NULL on failure
+ */
+aot *
+openAot(const struct emulator *chip8, const char *hash);
+
+/*
+ * Unload a compiled ROM.
+ *
+ * Parameter:
+ * the loaded ROM
+ */
+void
+unloadAot(aot *aot);
+
+/*
+ * Make every compiled block runnable again, e.g. after the ROM was reloaded.
+ *
+ * Parameter:
+ * the loaded ROM
+ */
+void
+resetAot(aot *aot);
+
+/*
+ * Disable the compiled blocks covering a written address.
+ *
+ * Parameters:
+ * the loaded ROM,
+ * the address that was written
+ */
+void
+invalidateAot(aot *aot, const uint16_t address);
+
+/*
+ * Execute instructions with the compiled blocks.
+ * Code that was not compiled runs through the interpreter.
+ * Stops early when the host has to draw, the machine powered off
+ * or the program reached an idle loop.
+ *
+ * Parameters:
+ * the emulator,
+ * the maximum number of instructions to execute
+ *
+ * Return:
+ * the number of instructions executed
+ */
+int
+runAot(struct emulator *chip8, const int budget);
+
+#endif /* AOT_H */
@@ -1,18 +1,38 @@
 #ifndef AUDIO_H
 #define AUDIO_H
 
+#include <stdatomic.h>
+#include <stdio.h>
+
 #include <SDL_audio.h>
 
+#define AUDIO_SAMPLE_RATE   44100
+#define AUDIO_PATTERN_BYTES 16          // XO-CHIP 128-bit audio pattern
+#define AUDIO_PATTERN_BITS  (AUDIO_PATTERN_BYTES * 8)
+#define AUDIO_RING_SAMPLES  8192        // ring capacity, a power of two
+#define AUDIO_LATENCY       2048        // most samples queued ahead of the device
+
 typedef struct {
     SDL_AudioDeviceID   deviceId;           // audio device ID
     SDL_AudioSpec       spec;               // audio specification
-    SDL_bool            playing;            // is audio playing?
     SDL_bool            poweredOn;          // power flag
-    double              phase;              // phase for waveform generation
+    SDL_bool            pending;            // the program changed the sound, stream up to here
+    uint8_t             pattern[AUDIO_PATTERN_BYTES]; // pattern buffer set by the program
+    uint8_t             pitch;              // XO-CHIP pitch register
+    uint32_t            step;               // phase increment set by the program
+    uint32_t            phase;              // position in the pattern, the top 7 bits select a bit
+    uint32_t            playingStep;        // phase increment being generated
+    Sint16              levels[AUDIO_PATTERN_BITS]; // the generated pattern expanded to samples
+    FILE                *wav;               // recording, NULL if not recording
+    uint32_t            wavSamples;         // samples recorded so far
+    atomic_uint         head;               // ring position written next by the emulator
+    atomic_uint         tail;               // ring position read next by the callback
+    Sint16              ring[AUDIO_RING_SAMPLES]; // samples waiting for the device
 } audio;
 
 /*
- * Audio callback function to generate a tone.
+ * Audio callback function to play the queued samples.
+ * Plays silence when the emulator fell behind.
  *
  * Parameters:
  * the audio structure,
@@ -23,7 +43,76 @@ void
 audioCallback(void *userdata, Uint8 *stream, const int len);
 
 /*
- * Initialize the audio system.
+ * Restore the default beep.
+ * Programs keep it until they load a pattern or set the pitch.
+ *
+ * Parameter:
+ * the audio structure
+ */
+void
+resetAudio(audio *audio);
+
+/*
+ * Load the XO-CHIP audio pattern.
+ * Takes effect from the next streamed sample.
+ *
+ * Parameters:
+ * the audio structure,
+ * the 16 bytes of the pattern
+ */
+void
+setAudioPattern(audio *audio, const uint8_t *pattern);
+
+/*
+ * Set the XO-CHIP pitch register.
+ * Patterns play at 4000 * 2^((pitch - 64) / 48) bits per second.
+ * Takes effect from the next streamed sample.
+ *
+ * Parameters:
+ * the audio structure,
+ * the pitch
+ */
+void
+setAudioPitch(audio *audio, const uint8_t pitch);
+
+/*
+ * Generate the sound of a stretch of emulated time,
+ * queue it for the device and append it to the recording.
+ * Sound changes made by the program take effect after it.
+ *
+ * Parameters:
+ * the audio structure,
+ * the number of samples to generate,
+ * whether the sound timer was running during them
+ */
+void
+streamAudio(audio *audio, const int samples, const SDL_bool playing);
+
+/*
+ * Start recording the streamed samples to a WAV file.
+ *
+ * Parameters:
+ * the audio structure,
+ * the path of the WAV file
+ *
+ * Return:
+ * 0 on success,
+ * -1 on failure
+ */
+int
+startRecording(audio *audio, const char *path);
+
+/*
+ * Finish the WAV file being recorded, if any.
+ *
+ * Parameter:
+ * the audio structure
+ */
+void
+stopRecording(audio *audio);
+
+/*
+ * Initialize the audio system and start the device.
  *
  * Parameter:
  * the audio structure
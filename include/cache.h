@@ -0,0 +1,155 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+
+struct emulator;
+
+/*
+ * Instruction forms with a dedicated handler, as (form, handler) pairs.
+ * Every other opcode runs through the reference decoder as FALLBACK.
+ */
+#define OPCODE_FORMS(X)     \
+    X(FALLBACK, opFallback) \
+    X(00EE, op00EE)         \
+    X(1NNN, op1NNN)         \
+    X(2NNN, op2NNN)         \
+    X(3XNN, op3XNN)         \
+    X(4XNN, op4XNN)         \
+    X(5XY0, op5XY0)         \
+    X(6XNN, op6XNN)         \
+    X(7XNN, op7XNN)         \
+    X(8XY0, op8XY0)         \
+    X(8XY1, op8XY1)         \
+    X(8XY2, op8XY2)         \
+    X(8XY3, op8XY3)         \
+    X(8XY4, op8XY4)         \
+    X(8XY5, op8XY5)         \
+    X(8XY6, op8XY6)         \
+    X(8XY7, op8XY7)         \
+    X(8XYE, op8XYE)         \
+    X(9XY0, op9XY0)         \
+    X(ANNN, opANNN)         \
+    X(BNNN, opBNNN)         \
+    X(CXNN, opCXNN)         \
+    X(EX9E, opEX9E)         \
+    X(EXA1, opEXA1)         \
+    X(FX07, opFX07)         \
+    X(FX15, opFX15)         \
+    X(FX1E, opFX1E)         \
+    X(FX29, opFX29)         \
+    X(FX33, opFX33)         \
+    X(FX55, opFX55)         \
+    X(FX65, opFX65)
+
+enum {
+#define X(form, handler) FORM_##form,
+    OPCODE_FORMS(X)
+#undef X
+    FORM_COUNT
+};
+
+/* longest run of adjacent instructions executed by one fused handler */
+#define FUSED_MAX_LENGTH    3
+
+typedef struct instruction instruction;
+
+/* handler executing a predecoded instruction */
+typedef void (*opcodeHandler)(struct emulator *chip8, const instruction *ins);
+
+struct instruction {
+    opcodeHandler   handler;                // NULL until decoded
+    uint16_t        opcode;                 // raw opcode
+    uint16_t        nnn;                    // 12-bit address operand
+    uint8_t         x;                      // register operand X
+    uint8_t         y;                      // register operand Y
+    uint8_t         n;                      // 4-bit operand
+    uint8_t         nn;                     // 8-bit operand
+    uint8_t         form;                   // index into the dispatch table
+    uint8_t         fused;                  // fused group starting here, 0 until matched
+    uint8_t         skip;                   // bytes a taken skip jumps over
+};
+
+/*
+ * Decode an opcode into a cache entry.
+ * Picks the handler for the opcode and extracts its operands.
+ * Opcodes without a dedicated handler are executed through
+ * decodeAndExecuteOpcode.
+ * A taken skip jumps two bytes, the cache sets it to four
+ * where the skipped instruction is F000 NNNN.
+ *
+ * Parameters:
+ * the cache entry to fill,
+ * an opcode
+ */
+void
+decodeInstruction(instruction *ins, const uint16_t opcode);
+
+/*
+ * Invalidate every cache entry.
+ *
+ * Parameter:
+ * the instruction cache
+ */
+void
+clearCache(instruction *cache);
+
+/*
+ * Invalidate the cache entries affected by a write to memory.
+ * Every entry whose instruction or fused group covers
+ * the address is invalidated.
+ *
+ * Parameters:
+ * the instruction cache,
+ * the address that was written
+ */
+void
+invalidateCache(instruction *cache, const uint16_t address);
+
+/*
+ * Execute the instruction at the program counter.
+ * The instruction is decoded on first use and kept in the cache
+ * until memory under it or the instruction it skips is written,
+ * or the spec changes.
+ *
+ * Parameter:
+ * the emulator
+ */
+void
+executeCachedInstruction(struct emulator *chip8);
+
+/*
+ * Execute predecoded instructions with direct-threaded dispatch.
+ * Uses computed goto where the compiler supports it and
+ * a function pointer table otherwise.
+ * Adjacent instructions listed in fusion.h run as one fused handler.
+ * Stops early when the host has to draw, the machine powered off
+ * or the program reached an idle loop.
+ *
+ * Parameters:
+ * the emulator,
+ * the maximum number of instructions to execute
+ *
+ * Return:
+ * the number of instructions executed
+ */
+int
+runThreaded(struct emulator *chip8, const int budget);
+
+/*
+ * Execute instructions with the emulator's dispatch engine.
+ * With VIP timing the budget and the result are machine cycles instead.
+ * Stops early when the host has to draw, the machine powered off
+ * or the program reached an idle loop.
+ *
+ * Parameters:
+ * the emulator,
+ * the maximum number of instructions to execute
+ *
+ * Return:
+ * the number of instructions executed
+ */
+int
+executeInstructions(struct emulator *chip8, const int budget);
+
+#endif /* CACHE_H */
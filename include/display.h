@@ -15,25 +15,48 @@
 #define SCHIP_WIDTH     128
 #define SCHIP_HEIGHT    64
 
+#define FRAMEBUFFER_WORDS   (SCHIP_WIDTH / 64)  // packed words per row of a plane
+#define DISPLAY_PLANES      2                   // XO-CHIP bitplanes
+#define ALL_ROWS            (~0ULL)             // row mask with every framebuffer row set
+
+/* pixel of a packed plane row, the leftmost pixel is the top bit of the first word */
+#define PIXEL_SET(row, x)   (((row)[(x) >> 6] >> (63 - ((x) & 63))) & 1)
+
+/* color index of a pixel in a framebuffer row, bit n is set in plane n */
+#define PIXEL_COLOR(row, x) (PIXEL_SET((row)[0], x) | PIXEL_SET((row)[1], x) << 1)
+
+/* a framebuffer row, the rows of every plane side by side */
+typedef uint64_t framebufferRow[DISPLAY_PLANES][FRAMEBUFFER_WORDS];
+
 typedef struct {
     SDL_Window      *window;                // window for the display
-    SDL_Renderer    *renderer;              // renderer for the display
-    SDL_Rect        *pixels;                // rectangles for each pixel
-    SDL_bool        *pixelDrawn;            // which pixels are drawn?
+    framebufferRow  framebuffer[SCHIP_HEIGHT];      // plane-packed rows of pixels
+    framebufferRow  drawnFramebuffer[SCHIP_HEIGHT]; // framebuffer as of the last draw, if kept
+    SDL_bool        keepDrawn;              // copy the framebuffer at every draw for drawnFramebuffer?
+    uint8_t         planes;                 // planes drawn to, bit n is plane n
+    SDL_bool        drawn;                  // was a sprite drawn since the last present?
+    uint64_t        dirtyRows;              // rows changed since the last draw or present, bit n is row n
+    uint64_t        drawnRows;              // rows changed up to the last draw and not yet presented
     SDL_bool        poweredOn;              // power flag
     SDL_bool        reset;                  // reset flag
     SDL_bool        keyDown[AMOUNT_KEYS];   // which keys are pressed?
     SDL_bool        keyUp[AMOUNT_KEYS];     // which keys are released?
     SDL_bool        dirty;                  // does display need redrawing?
-    uint32_t        lastUpdate;             // tick count at last update
-    int             width;                  // current width
-    int             height;                 // current height
-    int             pixelWidth;             // cached width / SCALE
-    int             pixelHeight;            // cached height / SCALE
+    uint64_t        vblank;                 // emulated frame the next sprite may be drawn in
+    int             pixelWidth;             // current width in pixels
+    int             pixelHeight;            // current height in pixels
 } display;
 
+/* keys and requests gathered from events on the main thread for the emulation thread */
+typedef struct {
+    SDL_bool        keyDown[AMOUNT_KEYS];   // which keys are pressed?
+    SDL_bool        keyUp[AMOUNT_KEYS];     // which keys were released since the input was taken?
+    SDL_bool        quit;                   // was the window closed or escape pressed?
+    SDL_bool        reset;                  // was a restart of the rom requested?
+} input;
+
 /*
- * Clear the pixels of the display.
+ * Clear every plane of the display and select the first plane.
  *
  * Parameter:
  * the display structure
@@ -42,13 +65,26 @@ void
 resetDisplay(display *display);
 
 /*
- * Create the pixels of the display.
+ * Clear the selected planes of the display.
  *
  * Parameter:
  * the display structure
  */
 void
-createPixels(display *display);
+clearDisplay(display *display);
+
+/*
+ * Switch the display resolution and clear it.
+ * The framebuffer always holds 128x64 pixels, so nothing is reallocated
+ * and the window keeps its size.
+ *
+ * Parameters:
+ * the display structure,
+ * the width in pixels (CHIP8_WIDTH or SCHIP_WIDTH),
+ * the height in pixels (CHIP8_HEIGHT or SCHIP_HEIGHT)
+ */
+void
+setResolution(display *display, const int width, const int height);
 
 /*
  * Initialize the display.
@@ -65,40 +101,84 @@ int
 initDisplay(display *display, const char *iconPath);
 
 /*
- * Handle an event.
+ * XOR a sprite onto the selected planes of the display.
+ * Rows are placed as whole words and every plane of a row is XORed and
+ * tested for collisions at once, using SSE2 or AVX2 where available.
+ * Sprites clip at the screen edges.
+ * The rows the sprite changed are marked dirty.
  *
  * Parameters:
  * the display structure,
- * the event to handle
+ * the sprite data, one or two bytes per row, one sprite after the other
+ * for each selected plane,
+ * the number of rows,
+ * the number of bytes per row (1 for 8 pixels wide, 2 for 16 pixels wide),
+ * the x coordinate (wraps around the screen width),
+ * the y coordinate (wraps around the screen height)
+ *
+ * Return:
+ * the number of rows in which a set pixel of any plane was cleared
+ */
+int
+drawSprite(
+    display *display,
+    const uint8_t *sprite,
+    const int rows,
+    const int bytesPerRow,
+    const int x,
+    const int y
+);
+
+/*
+ * Scroll the selected planes down, the rows scrolled in at the top are blank.
+ *
+ * Parameters:
+ * the display structure,
+ * the number of rows to scroll by
  */
 void
-handleEvent(display *display, const SDL_Event *event);
+scrollDown(display *display, const int lines);
 
 /*
- * Draw the background of the display.
+ * Scroll the selected planes right, the columns scrolled in at the left are blank.
  *
- * Parameter:
- * the display structure
+ * Parameters:
+ * the display structure,
+ * the number of pixels to scroll by (less than 64)
+ */
+void
+scrollRight(display *display, const int pixels);
+
+/*
+ * Scroll the selected planes left, the columns scrolled in at the right are blank.
  *
- * Return:
- * 0 on success,
- * -1 on failure
+ * Parameters:
+ * the display structure,
+ * the number of pixels to scroll by (less than 64)
  */
-int
-drawBackground(display *display);
+void
+scrollLeft(display *display, const int pixels);
 
 /*
- * Draw the pixels of the display.
+ * Handle an event.
  *
- * Parameter:
- * the display structure
+ * Parameters:
+ * the input gathered so far,
+ * the event to handle
+ */
+void
+handleEvent(input *input, const SDL_Event *event);
+
+/*
+ * Hand the input gathered from events to the display.
+ * Key releases are cleared once taken, so every release is seen by one frame.
  *
- * Return:
- * 0 on success,
- * -1 on failure
+ * Parameters:
+ * the display structure,
+ * the input gathered since it was last taken
  */
-int
-drawPixels(display *display);
+void
+takeInput(display *display, input *input);
 
 /*
  * Clear keypress events.
@@ -5,19 +5,39 @@
 
 #include <SDL_log.h>
 
+#include "../include/aot.h"
 #include "../include/audio.h"
+#include "../include/cache.h"
 #include "../include/display.h"
+#include "../include/jit.h"
 #include "../include/stack.h"
 #include "../include/timers.h"
+#include "../include/vip.h"
 
-#define AMOUNT_MEMORY_BYTES 0x1000
+#define AMOUNT_MEMORY_BYTES 0x10000
 
 #define AMOUNT_REGISTERS    16
 
 #define DEFAULT_IPS         1000
+#define MAX_IPS             1000000000  // keeps a frame's budget within an int
 
 #define CHIP8               100
 #define SCHIP               101
+#define XOCHIP              102
+
+#define DISPATCH_SWITCH     200
+#define DISPATCH_CACHED     201
+#define DISPATCH_THREADED   202
+#define DISPATCH_JIT        203
+#define DISPATCH_AOT        204
+
+#define VBLANK_AUTO         400         // sprites wait for vertical blank in CHIP-8 programs only
+#define VBLANK_ON           401
+#define VBLANK_OFF          402
+
+#define STATE_RUNNING       500
+#define STATE_VBLANK        501         // a sprite waits for the next vertical blank
+#define STATE_KEY           502         // FX0A waits for a key to be released
 
 /* long options for getopt_long */
 static struct option longOptions[] =
@@ -25,23 +45,38 @@ static struct option longOptions[] =
     {"force", no_argument, NULL, 'f'},
     {"mute", no_argument, NULL, 'm'},
     {"ips", required_argument, NULL, 'i'},
+    {"cycles", required_argument, NULL, 'c'},
+    {"dispatch", required_argument, NULL, 'd'},
+    {"present", required_argument, NULL, 'p'},
+    {"aot", no_argument, NULL, 'a'},
+    {"output", required_argument, NULL, 'o'},
+    {"wav", required_argument, NULL, 'w'},
+    {"vblank", required_argument, NULL, 'b'},
+    {"timing", required_argument, NULL, 't'},
+    {"headless", required_argument, NULL, 'H'},
     {"help", no_argument, NULL, 'h'},
     {"version", no_argument, NULL, 'v'},
     {0, 0, 0, 0} // end of array
 };
 
-typedef struct {
-    uint8_t     memory[AMOUNT_MEMORY_BYTES];    // 4KB memory
+typedef struct emulator {
+    uint8_t     memory[AMOUNT_MEMORY_BYTES];    // 64KB memory, as on XO-CHIP
     uint8_t     v[AMOUNT_REGISTERS];            // 16 8-bit registers
-    uint8_t     specType;                       // chip8 or schip
+    uint8_t     specType;                       // chip8, schip or xochip
     uint16_t    i;                              // 16-bit address register
     uint16_t    pc;                             // program counter
-    uint32_t    lastUpdate;                     // last update tick
+    uint16_t    state;                          // running or waiting for the host
     timers      timers;                         // delay & sound timers
     stack       stack;                          // stack & stack pointer
     display     display;                        // display structure
     audio       sound;                          // sound structure
     SDL_bool    muted;                          // is the sound muted?
+    uint8_t     dispatch;                       // instruction dispatch engine
+    int         vblankQuirk;                    // display wait quirk, auto follows the spec
+    instruction cache[AMOUNT_MEMORY_BYTES];     // predecoded instructions
+    uint8_t     cacheSpecType;                  // spec the cache was decoded for
+    jit         *jit;                           // recompiler, NULL if unused
+    aot         *aot;                           // compiled ROM, NULL if unused
 } emulator;
 
 /*
@@ -93,6 +128,45 @@ getExecutablePathLINUX();
 char *
 getWindowIconPath(char *binPath);
 
+/*
+ * Get the dispatch engine named by a string.
+ *
+ * Parameter:
+ * the name of the dispatch engine
+ *
+ * Return:
+ * the dispatch engine,
+ * 0 if the name is not recognized
+ */
+uint8_t
+getDispatchEngine(const char *name);
+
+/*
+ * Get the display wait quirk named by a string.
+ *
+ * Parameter:
+ * the name of the setting, auto, on or off
+ *
+ * Return:
+ * the quirk setting,
+ * 0 if the name is not recognized
+ */
+int
+getVblankQuirk(const char *name);
+
+/*
+ * Get the timing model named by a string.
+ *
+ * Parameter:
+ * the name of the timing model, ips or vip
+ *
+ * Return:
+ * the timing model,
+ * 0 if the name is not recognized
+ */
+int
+getTimingModel(const char *name);
+
 /*
  * Check if a string is a number.
  *
@@ -185,6 +259,145 @@ randomNumber(int min, int max);
 uint16_t
 fetchOpcode(emulator *chip8);
 
+/*
+ * Write a byte to memory.
+ * Writes outside of memory are ignored.
+ * Any cached instruction overlapping the address is invalidated.
+ *
+ * Parameters:
+ * the emulator,
+ * the address to write,
+ * the value to write
+ */
+void
+writeMemory(emulator *chip8, const uint32_t address, const uint8_t value);
+
+/*
+ * Check whether an opcode conditionally skips the next instruction.
+ *
+ * Parameter:
+ * an opcode
+ *
+ * Return:
+ * SDL_TRUE for 3XNN, 4XNN, 5XY0, 9XY0, EX9E and EXA1,
+ * SDL_FALSE otherwise
+ */
+SDL_bool
+isSkip(const uint16_t opcode);
+
+/*
+ * Get the number of planes a sprite is drawn to, one sprite each.
+ *
+ * Parameter:
+ * the emulator
+ *
+ * Return:
+ * the number of selected planes
+ */
+int
+getSpritePlanes(const emulator *chip8);
+
+/*
+ * Get the number of rows DXYN draws to each selected plane.
+ * N = 0 draws 16 rows of 2 bytes, rows past the end of memory are not drawn.
+ *
+ * Parameters:
+ * the emulator,
+ * the N of the instruction
+ *
+ * Return:
+ * the number of rows
+ */
+int
+getSpriteRows(const emulator *chip8, const uint8_t n);
+
+/*
+ * Get the number of bytes skipping the instruction at an address jumps over.
+ * The 4-byte F000 NNNN instruction is skipped as a whole whatever the spec,
+ * as F000 is no CHIP-8 or SCHIP opcode and XO-CHIP is only detected once
+ * its first opcode has run, which may be the skipped one.
+ *
+ * Parameters:
+ * the emulator,
+ * the address of the skipped instruction
+ *
+ * Return:
+ * 4 for F000 NNNN,
+ * 2 otherwise
+ */
+uint16_t
+getSkipLength(const emulator *chip8, const uint16_t address);
+
+/*
+ * Skip the next instruction.
+ * The 4-byte F000 NNNN instruction is skipped as a whole.
+ *
+ * Parameter:
+ * the emulator
+ */
+void
+skipInstruction(emulator *chip8);
+
+/*
+ * Check whether the host has to run before the next instruction,
+ * to present the display, to stream the sound up to a change of it,
+ * because the program waits for the host or because the machine powered off.
+ *
+ * Parameter:
+ * the emulator
+ *
+ * Return:
+ * SDL_TRUE if the host has to run,
+ * SDL_FALSE otherwise
+ */
+SDL_bool
+hostNeeded(const emulator *chip8);
+
+/*
+ * Check whether an instruction heads a loop that can idle until the next timer tick,
+ * whatever the timers hold: a jump to self or FX07 / 3XNN or 4XNN / 1NNN.
+ * The engines stop at such an instruction whenever isIdle holds there,
+ * so the frame ends at the same instruction whichever engine runs it.
+ *
+ * Parameters:
+ * the emulator,
+ * the address of the instruction
+ *
+ * Return:
+ * SDL_TRUE if the instruction heads an idle loop,
+ * SDL_FALSE otherwise
+ */
+SDL_bool
+isIdleLoop(const emulator *chip8, const uint16_t address);
+
+/*
+ * Check whether the program is idle until the next timer tick.
+ * Detects jumps to self and FX07 / 3XNN or 4XNN / 1NNN loops polling
+ * the delay timer. For a timer loop the register it polls into is set
+ * as the loop would set it, so skipping ahead to the tick is exact.
+ *
+ * Parameter:
+ * the emulator
+ *
+ * Return:
+ * SDL_TRUE if nothing can change before the next timer tick,
+ * SDL_FALSE otherwise
+ */
+SDL_bool
+isIdle(emulator *chip8);
+
+/*
+ * Run one 60Hz frame of emulated time.
+ * Ticks the timers, executes the frame's instructions and streams its sound.
+ * Never looks at the wall clock, so the same input gives the same frames
+ * however fast they are run.
+ *
+ * Parameter:
+ * the emulator
+ */
+void
+runFrame(emulator *chip8);
+
 /*
  * Decode and execute an opcode.
  *
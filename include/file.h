@@ -65,18 +65,34 @@ getHash(FILE *romFile);
 void
 printRomInfo(cJSON *romInfo, cJSON *romHash);
 
+/*
+ * Get the vertical blank quirk of a ROM from its database entry,
+ * as set for the first platform it runs on.
+ *
+ * Parameters:
+ * cJSON object containing information about the ROM,
+ * the ROM hash
+ *
+ * Return:
+ * VBLANK_ON or VBLANK_OFF,
+ * VBLANK_AUTO if the entry names no platform
+ */
+int
+getRomVblank(cJSON *romInfo, const char *hashString);
+
 /*
  * Check if a ROM file is in the database.
  *
- * Parameter:
- * the ROM file
+ * Parameters:
+ * the ROM file,
+ * set to the ROM's vertical blank quirk when the database has it
  *
  * Return:
  * SDL_TRUE if the ROM is in the database,
  * SDL_FALSE if the ROM is not in the database
  */
 SDL_bool
-isRomInDatabase(FILE *romFile);
+isRomInDatabase(FILE *romFile, int *vblank);
 
 /*
  * Check if a ROM is valid.
@@ -86,13 +102,14 @@ isRomInDatabase(FILE *romFile);
  * Parameters:
  * the name of the ROM,
  * the ROM,
- * the stat structure
+ * the stat structure,
+ * set to the ROM's vertical blank quirk when the database has it
  *
  * Return:
  * SDL_TRUE if the ROM is valid,
  * SDL_FALSE if the ROM is not valid
  */
 SDL_bool
-isRomValid(const char *romName, FILE *romFile, struct stat *st);
+isRomValid(const char *romName, FILE *romFile, struct stat *st, int *vblank);
 
 #endif /* FILE_H */
@@ -0,0 +1,46 @@
+#ifndef FUSION_H
+#define FUSION_H
+
+/*
+ * Instruction sequences executed by fused handlers.
+ * Generated by fusiongen from 31 ROMs (62000000 instructions), do not edit;
+ * run `make fusion` to regenerate. Shares are of all executed instructions.
+ */
+
+#define FUSED_PAIRS(X) \
+    X(3XNN, 1NNN)           /* 11.23% */ \
+    X(FX07, 3XNN)           /* 10.20% */ \
+    X(EXA1, 1NNN)           /*  2.73% */ \
+    X(ANNN, FX1E)           /*  1.23% */ \
+    X(7XNN, 3XNN)           /*  1.20% */ \
+    X(7XNN, 4XNN)           /*  0.86% */ \
+    X(6XNN, EXA1)           /*  0.84% */ \
+    X(FX1E, 7XNN)           /*  0.72% */ \
+    X(EX9E, 1NNN)           /*  0.69% */ \
+    X(FX1E, FX65)           /*  0.54% */ \
+    X(6XNN, FX15)           /*  0.47% */ \
+    X(FX15, 00EE)           /*  0.43% */ \
+    X(7XNN, 7XNN)           /*  0.38% */ \
+    X(EXA1, 6XNN)           /*  0.34% */ \
+    X(8XY0, 8XY0)           /*  0.34% */ \
+    X(6XNN, 6XNN)           /*  0.33% */ \
+    X(6XNN, EX9E)           /*  0.33% */ \
+    X(4XNN, 1NNN)           /*  0.31% */ \
+    X(8XYE, 8XYE)           /*  0.26% */ \
+    X(4XNN, 7XNN)           /*  0.24% */ \
+    X(7XNN, 5XY0)           /*  0.24% */ \
+    X(7XNN, 6XNN)           /*  0.23% */ \
+    X(FX65, 6XNN)           /*  0.22% */ \
+    X(FX1E, 6XNN)           /*  0.22% */
+
+#define FUSED_TRIPLES(X) \
+    X(FX07, 3XNN, 1NNN)     /*  9.45% */ \
+    X(7XNN, 3XNN, 1NNN)     /*  1.12% */ \
+    X(ANNN, FX1E, FX65)     /*  0.49% */ \
+    X(FX1E, 7XNN, 3XNN)     /*  0.44% */ \
+    X(6XNN, FX15, 00EE)     /*  0.38% */ \
+    X(FX1E, 7XNN, 4XNN)     /*  0.27% */ \
+    X(EXA1, 6XNN, EXA1)     /*  0.24% */ \
+    X(7XNN, 7XNN, 5XY0)     /*  0.24% */
+
+#endif /* FUSION_H */
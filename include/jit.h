@@ -0,0 +1,67 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+
+struct emulator;
+
+/* basic-block recompiler state, only available on x86-64 hosts */
+typedef struct jit jit;
+
+/*
+ * Create a basic-block recompiler.
+ * Allocates the executable code buffer.
+ *
+ * Return:
+ * the recompiler,
+ * NULL if the host is not supported or allocation failed
+ */
+jit *
+createJit(void);
+
+/*
+ * Destroy a basic-block recompiler and release its code buffer.
+ *
+ * Parameter:
+ * the recompiler
+ */
+void
+destroyJit(jit *jit);
+
+/*
+ * Discard every translated block.
+ *
+ * Parameter:
+ * the recompiler
+ */
+void
+flushJit(jit *jit);
+
+/*
+ * Invalidate the translated blocks covering a written address.
+ * Blocks chained into an invalidated block fall back to the dispatcher.
+ *
+ * Parameters:
+ * the recompiler,
+ * the address that was written
+ */
+void
+invalidateJit(jit *jit, const uint16_t address);
+
+/*
+ * Execute instructions as translated native code.
+ * Blocks are translated on first use and chained on static jumps.
+ * Stops early when the host has to draw, the machine powered off
+ * or the program reached an idle loop.
+ *
+ * Parameters:
+ * the emulator,
+ * the maximum number of instructions to execute
+ *
+ * Return:
+ * the number of instructions executed
+ */
+int
+runJit(struct emulator *chip8, const int budget);
+
+#endif /* JIT_H */
@@ -0,0 +1,71 @@
+#ifndef PACING_H
+#define PACING_H
+
+#include <stdint.h>
+
+#define NS_PER_SECOND   1000000000ULL
+#define NS_PER_MS       1000000ULL
+#define PACER_MAX_LATE  2                   // frames run back to back to catch up after a stall
+
+typedef struct {
+    uint64_t    origin;                 // monotonic time of the first frame in ns
+    uint64_t    frame;                  // index of the next frame since origin
+    uint32_t    rate;                   // frames per second
+} pacer;
+
+/*
+ * Get the current time of the monotonic clock.
+ *
+ * Return:
+ * the time in nanoseconds
+ */
+uint64_t
+getMonotonicTime(void);
+
+/*
+ * Sleep until an absolute time of the monotonic clock.
+ * Returns immediately if the time has already passed.
+ *
+ * Parameter:
+ * the time to wake up at in nanoseconds
+ */
+void
+sleepUntil(const uint64_t deadline);
+
+/*
+ * Start pacing frames from now.
+ *
+ * Parameters:
+ * the pacer,
+ * the number of frames per second
+ */
+void
+startPacer(pacer *pacer, const uint32_t rate);
+
+/*
+ * Get the time left until the next frame is due.
+ *
+ * Parameter:
+ * the pacer
+ *
+ * Return:
+ * the time in nanoseconds,
+ * 0 if the frame is already due
+ */
+uint64_t
+getTimeToFrame(const pacer *pacer);
+
+/*
+ * Sleep until the next frame is due.
+ * Deadlines are computed from the start of pacing rather than
+ * the previous wake-up, so oversleeping does not accumulate drift.
+ * A short stall is caught up by returning at once for the late frames,
+ * when more than PACER_MAX_LATE frames behind the missed frames are dropped.
+ *
+ * Parameter:
+ * the pacer
+ */
+void
+waitForFrame(pacer *pacer);
+
+#endif /* PACING_H */
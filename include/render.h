@@ -0,0 +1,111 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdatomic.h>
+
+#include <SDL_render.h>
+#include <SDL_video.h>
+
+#include "../include/display.h"
+
+#define RENDER_BUFFERS      3           // triple buffering
+#define RENDER_FRESH        0x4         // set on the shared index when it holds an unseen frame
+
+/* presentation policies */
+#define PRESENT_VSYNC       300         // present the latest frame once per host refresh
+#define PRESENT_FIXED       301         // present the latest frame at a fixed 60Hz
+#define PRESENT_LAST_DRAW   302         // like vsync, showing the display as of each frame's last draw
+
+#define RENDER_WAKE_TIMEOUT_MS  100     // the main thread looks at the emulation thread at least this often
+#define RENDER_FIXED_RATE       60      // presents per second of the fixed policy
+
+/* a completed frame handed from the emulation thread to the main thread */
+typedef struct {
+    framebufferRow  framebuffer[SCHIP_HEIGHT]; // plane-packed rows of pixels
+    uint64_t        rows;                   // rows changed since the frame last taken by the main thread
+    int             pixelWidth;             // width in pixels
+    int             pixelHeight;            // height in pixels
+} frame;
+
+typedef struct {
+    SDL_Window      *window;                // window presented to
+    SDL_Renderer    *renderer;              // used on the main thread only
+    SDL_Texture     *texture;               // streaming texture sized for hi-res
+    Uint32          wakeEvent;              // event pushed to the main thread when a frame is published
+    atomic_int      shared;                 // buffer index exchanged between the threads
+    uint64_t        unseenRows;             // rows changed since the frame last taken, kept by the emulator
+    int             back;                   // buffer index being written by the emulator
+    int             front;                  // buffer index being shown by the main thread
+    int             policy;                 // presentation policy
+    frame           frames[RENDER_BUFFERS]; // triple buffer
+    Uint32          texels[SCHIP_HEIGHT * SCHIP_WIDTH]; // converted rows waiting for upload
+} presenter;
+
+/*
+ * Get the presentation policy named by a string.
+ *
+ * Parameter:
+ * the name of the policy
+ *
+ * Return:
+ * the presentation policy,
+ * 0 if the name is not recognized
+ */
+int
+getPresentPolicy(const char *name);
+
+/*
+ * Create the renderer for the window.
+ * Must be called on the main thread, which presents from then on
+ * while the emulation thread publishes frames.
+ *
+ * Parameters:
+ * the presenter,
+ * the window to present to,
+ * the presentation policy
+ *
+ * Return:
+ * 0 on success,
+ * -1 on failure
+ */
+int
+startPresenter(presenter *presenter, SDL_Window *window, const int policy);
+
+/*
+ * Publish the end of an emulated frame if it has anything new to show.
+ * Never waits for a present: frames the main thread did not get to are replaced.
+ * Every frame carries the rows changed since the frame the main thread last took,
+ * so the rows of replaced frames are uploaded with the frame replacing them.
+ * Unless presents are paced at a fixed rate, the main thread is woken with wakeEvent.
+ *
+ * Parameters:
+ * the presenter,
+ * the display structure
+ */
+void
+publishFrame(presenter *presenter, display *display);
+
+/*
+ * Present the latest published frame if it was not shown yet.
+ * Must be called on the main thread; with vsync it waits for the host refresh.
+ *
+ * Parameter:
+ * the presenter
+ *
+ * Return:
+ * 0 on success,
+ * -1 on failure
+ */
+int
+presentFrame(presenter *presenter);
+
+/*
+ * Destroy the renderer.
+ *
+ * Parameter:
+ * the presenter
+ */
+void
+stopPresenter(presenter *presenter);
+
+#endif /* RENDER_H */
@@ -3,10 +3,23 @@
 
 #include <stdint.h>
 
+#define FRAMES_PER_SECOND   60          // timer ticks and vertical blanks per second
+
+#define TIMING_IPS          600         // every instruction takes the same time
+#define TIMING_VIP          601         // instructions take their COSMAC VIP machine cycles
+
+#define VIP_FRAME_CYCLES    3668        // VIP machine cycles per frame, 60 frames a second
+#define VIP_INTERRUPT_CYCLES 1832       // taken by the display interrupt and its DMA every frame
+
+/* the timers and the emulated clock they tick on */
 typedef struct {
     uint8_t     delay;                  // delay timer
     uint8_t     sound;                  // sound timer
-    uint32_t    lastUpdate;             // tick count at last update
+    uint64_t    cycle;                  // instructions or VIP machine cycles elapsed since power-on
+    uint64_t    frame;                  // emulated 60Hz frames elapsed since power-on
+    uint32_t    rate;                   // emulated instructions per second
+    uint32_t    cyclesPerFrame;         // fixed instructions per frame, 0 to derive from rate
+    int         model;                  // timing model, what the clock counts
 } timers;
 
 #endif /* TIMERS_H */
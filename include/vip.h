@@ -0,0 +1,24 @@
+#ifndef VIP_H
+#define VIP_H
+
+#include <stdint.h>
+
+struct emulator;
+
+/*
+ * Execute instructions charging each its COSMAC VIP machine cycles.
+ * Runs on the reference decoder, an instruction is started as long
+ * as the budget is not spent, so the last one may overrun it.
+ * Stops early when the host has to run or the program idles.
+ *
+ * Parameters:
+ * the emulator,
+ * the machine cycles left to the interpreter in this frame
+ *
+ * Return:
+ * the number of machine cycles spent
+ */
+int
+runVip(struct emulator *chip8, const int budget);
+
+#endif /* VIP_H */
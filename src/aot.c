@@ -0,0 +1,713 @@
+#include <dlfcn.h>
+#include <errno.h>
+#include <limits.h>
+#include <spawn.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../include/emulator.h"
+
+#define AOT_ABI_VERSION         5
+#define AOT_START_ADDRESS       0x200
+#define AOT_MAX_BLOCK_LEN       256
+#define AOT_ABI_LEN             256
+
+/* how an instruction is handled by the compiler */
+#define AOT_NATIVE              0   // compiled inline, falls through
+#define AOT_BRANCH              1   // compiled inline, ends the block
+#define AOT_INTERPRET           2   // left to the interpreter
+
+extern char **environ;
+
+struct aot {
+    void            *handle;                        // dlopen handle
+    const aotBlock  *blocks;                        // exported block table
+    int             count;                          // number of blocks
+    const aotBlock  *entries[AMOUNT_MEMORY_BYTES];  // runnable block by address
+    uint8_t         covered[AMOUNT_MEMORY_BYTES];   // address inside some block?
+};
+
+/*
+ * Describe the emulator layout the generated code depends on.
+ * A shared object is only loaded if its description matches.
+ */
+static void
+getAbi(char *abi, const size_t len)
+{
+    snprintf(
+        abi,
+        len,
+        "teal8-aot-%d:%zu:%zu:%zu:%zu:%zu:%zu:%zu:%zu:%zu:%zu:%zu",
+        AOT_ABI_VERSION,
+        sizeof(emulator),
+        offsetof(emulator, memory),
+        offsetof(emulator, v),
+        offsetof(emulator, i),
+        offsetof(emulator, pc),
+        offsetof(emulator, specType),
+        offsetof(emulator, timers.delay),
+        offsetof(emulator, stack.s),
+        offsetof(emulator, stack.sp),
+        offsetof(emulator, display.keyDown),
+        sizeof(SDL_bool)
+    );
+}
+
+static uint16_t
+readOpcode(const emulator *chip8, const uint16_t addr)
+{
+    return (chip8->memory[addr] << 8) | chip8->memory[addr + 1];
+}
+
+/* is the instruction after an address F000 NNNN, which is skipped as a whole? */
+static SDL_bool
+precedesLongSkip(const emulator *chip8, const uint16_t addr)
+{
+    return addr + 3 < AMOUNT_MEMORY_BYTES && readOpcode(chip8, addr + 2) == 0xF000;
+}
+
+static int
+classify(const uint16_t opcode)
+{
+    switch (opcode >> 12) {
+        case 0x1:
+        case 0x2:
+        case 0x3:
+        case 0x4:
+        case 0x9:
+            return AOT_BRANCH;
+        case 0x5:
+            /* 5XY2 and 5XY3 are XO-CHIP */
+            return (opcode & 0x000F) == 0x0 ? AOT_BRANCH : AOT_INTERPRET;
+        case 0x6:
+        case 0x7:
+        case 0x8:
+        case 0xA:
+            return AOT_NATIVE;
+        case 0xE:
+            if ((opcode & 0x00FF) == 0x9E || (opcode & 0x00FF) == 0xA1)
+                return AOT_BRANCH;
+            return AOT_NATIVE;                      // no-op in the reference
+        case 0xF:
+            switch (opcode & 0x00FF) {
+                case 0x07:
+                case 0x15:
+                case 0x1E:
+                case 0x29:
+                case 0x65:
+                    return AOT_NATIVE;
+            }
+            break;
+    }
+
+    /* drawing, randomness, sound, stores, returns and computed jumps */
+    return AOT_INTERPRET;
+}
+
+/*
+ * Mark the code reachable from the start address.
+ * Block leaders are the start address, branch targets, idle loops
+ * and the instructions following interpreted ones.
+ */
+static void
+findReachable(const emulator *chip8, uint8_t *reached, uint8_t *leaders)
+{
+    static uint16_t work[AMOUNT_MEMORY_BYTES * 2];
+    int             top = 0;
+
+    work[top++]                 = AOT_START_ADDRESS;
+    leaders[AOT_START_ADDRESS]  = 1;
+
+    while (top > 0) {
+        const uint16_t addr = work[--top];
+        if (addr >= AMOUNT_MEMORY_BYTES - 1 || reached[addr])
+            continue;
+        reached[addr] = 1;
+
+        /* the dispatcher checks idle loops before running them */
+        if (isIdleLoop(chip8, addr))
+            leaders[addr] = 1;
+
+        const uint16_t  opcode  = readOpcode(chip8, addr);
+        const uint16_t  nnn     = opcode & 0x0FFF;
+
+        /* queue a successor, counting it as a leader unless it falls through */
+        #define FOLLOW(target, leader)                              \
+            do {                                                    \
+                if ((target) < AMOUNT_MEMORY_BYTES - 1) {           \
+                    if (leader)                                     \
+                        leaders[(target)] = 1;                      \
+                    if (top < AMOUNT_MEMORY_BYTES * 2)              \
+                        work[top++] = (target);                     \
+                }                                                   \
+            } while (0)
+
+        switch (classify(opcode)) {
+            case AOT_NATIVE:
+                FOLLOW(addr + 2, 0);
+                break;
+            case AOT_BRANCH:
+                if (opcode >> 12 == 0x1) {
+                    FOLLOW(nnn, 1);
+                } else if (opcode >> 12 == 0x2) {
+                    FOLLOW(nnn, 1);
+                    FOLLOW(addr + 2, 1);            // return site
+                } else {
+                    FOLLOW(addr + 2, 1);
+                    FOLLOW(precedesLongSkip(chip8, addr) ? addr + 6 : addr + 4, 1);
+                }
+                break;
+            default:
+                /* returns, exits and computed jumps have no static successor */
+                if (
+                    opcode != 0x00EE
+                    &&
+                    opcode != 0x00FD
+                    &&
+                    opcode >> 12 != 0xB
+                )
+                    FOLLOW(addr + 2, 1);
+                break;
+        }
+
+        #undef FOLLOW
+    }
+}
+
+/*
+ * Emit the C code of one instruction.
+ * A taken skip over F000 NNNN jumps over all 4 bytes of it.
+ */
+static void
+emitInstruction(FILE *out, const emulator *chip8, const uint16_t addr, const uint16_t opcode)
+{
+    const uint8_t   x   = (opcode & 0x0F00) >> 8;
+    const uint8_t   y   = (opcode & 0x00F0) >> 4;
+    const uint8_t   nn  = opcode & 0x00FF;
+    const uint16_t  nnn = opcode & 0x0FFF;
+    const uint16_t  skip    = precedesLongSkip(chip8, addr) ? addr + 6 : addr + 4;
+
+    fprintf(out, "    /* %03X: %04X */\n", addr, opcode);
+
+    switch (opcode >> 12) {
+        case 0x1:
+            fprintf(out, "    PC = 0x%03X;\n", nnn);
+            break;
+        case 0x2:
+            fprintf(out, "    if (SP < %d) { STACK(SP) = 0x%03X; SP++; }\n", STACK_LEVELS, addr + 2);
+            fprintf(out, "    PC = 0x%03X;\n", nnn);
+            break;
+        case 0x3:
+            fprintf(out, "    PC = V(%d) == %d ? 0x%03X : 0x%03X;\n", x, nn, skip, addr + 2);
+            break;
+        case 0x4:
+            fprintf(out, "    PC = V(%d) != %d ? 0x%03X : 0x%03X;\n", x, nn, skip, addr + 2);
+            break;
+        case 0x5:
+            fprintf(out, "    PC = V(%d) == V(%d) ? 0x%03X : 0x%03X;\n", x, y, skip, addr + 2);
+            break;
+        case 0x9:
+            fprintf(out, "    PC = V(%d) != V(%d) ? 0x%03X : 0x%03X;\n", x, y, skip, addr + 2);
+            break;
+        case 0x6:
+            fprintf(out, "    V(%d) = %d;\n", x, nn);
+            break;
+        case 0x7:
+            fprintf(out, "    V(%d) += %d;\n", x, nn);
+            break;
+        case 0x8:
+            switch (opcode & 0x000F) {
+                case 0x0:
+                    fprintf(out, "    V(%d) = V(%d);\n", x, y);
+                    break;
+                case 0x1:
+                case 0x2:
+                case 0x3:
+                    fprintf(
+                        out,
+                        "    V(%d) %c= V(%d);\n"
+                        "    if (SPEC == %d) V(15) = 0;\n",
+                        x,
+                        "|&^"[(opcode & 0x000F) - 1],
+                        y,
+                        CHIP8
+                    );
+                    break;
+                case 0x4:
+                    fprintf(
+                        out,
+                        "    a = V(%d); b = V(%d); V(%d) = a + b; V(15) = a > 0xFF - b;\n",
+                        x, y, x
+                    );
+                    break;
+                case 0x5:
+                    fprintf(
+                        out,
+                        "    a = V(%d); b = V(%d); V(%d) = a - b; V(15) = a >= b;\n",
+                        x, y, x
+                    );
+                    break;
+                case 0x7:
+                    fprintf(
+                        out,
+                        "    a = V(%d); b = V(%d); V(%d) = a - b; V(15) = a >= b;\n",
+                        y, x, x
+                    );
+                    break;
+                case 0x6:
+                case 0xE:
+                    fprintf(
+                        out,
+                        "    a = V(%d); if (SPEC != %d) V(%d) = V(%d);\n"
+                        "    V(%d) %s= 1; V(15) = %s;\n",
+                        x, SCHIP, x, y,
+                        x, (opcode & 0x000F) == 0x6 ? ">>" : "<<",
+                        (opcode & 0x000F) == 0x6 ? "a & 0x01" : "a >> 7"
+                    );
+                    break;
+            }
+            break;
+        case 0xA:
+            fprintf(out, "    I = 0x%03X;\n", nnn);
+            break;
+        case 0xE:
+            if (nn == 0x9E)
+                fprintf(out, "    PC = KEY(V(%d)) ? 0x%03X : 0x%03X;\n", x, skip, addr + 2);
+            else if (nn == 0xA1)
+                fprintf(out, "    PC = !KEY(V(%d)) ? 0x%03X : 0x%03X;\n", x, skip, addr + 2);
+            break;
+        case 0xF:
+            switch (nn) {
+                case 0x07:
+                    fprintf(out, "    V(%d) = DELAY;\n", x);
+                    break;
+                case 0x15:
+                    fprintf(out, "    DELAY = V(%d);\n", x);
+                    break;
+                case 0x1E:
+                    fprintf(out, "    I += V(%d);\n", x);
+                    break;
+                case 0x29:
+                    fprintf(out, "    I = (V(%d) & 0x0F) * 5;\n", x);
+                    break;
+                case 0x65:
+                    fprintf(
+                        out,
+                        "    for (int k = 0; k <= %d; k++)\n"
+                        "        if (I + k < %d) V(k) = MEM(I + k);\n"
+                        "    if (SPEC != %d) I += %d;\n",
+                        x, AMOUNT_MEMORY_BYTES, SCHIP, x + 1
+                    );
+                    break;
+            }
+            break;
+    }
+}
+
+/*
+ * Emit the function for the block starting at a leader.
+ *
+ * Return:
+ * the number of instructions in the block,
+ * 0 if the leader is not compiled
+ */
+static int
+emitBlock(FILE *out, const emulator *chip8, const uint16_t start, uint16_t *end)
+{
+    uint16_t    addr    = start;
+    int         length  = 0;
+    SDL_bool    ended   = SDL_FALSE;
+
+    if (start >= AMOUNT_MEMORY_BYTES - 2 || classify(readOpcode(chip8, start)) == AOT_INTERPRET)
+        return 0;
+
+    fprintf(out, "static void\nb%03X(uint8_t *c)\n{\n    uint8_t a, b;\n    (void)a; (void)b;\n", start);
+
+    /* the last instruction in memory is interpreted, so block ends fit in 16 bits */
+    while (!ended && length < AOT_MAX_BLOCK_LEN && addr < AMOUNT_MEMORY_BYTES - 2) {
+        const uint16_t  opcode  = readOpcode(chip8, addr);
+        const int       kind    = classify(opcode);
+
+        if (kind == AOT_INTERPRET || (length > 0 && isIdleLoop(chip8, addr)))
+            break;
+
+        emitInstruction(out, chip8, addr, opcode);
+        ended = kind == AOT_BRANCH;
+        addr += 2;
+        length++;
+    }
+
+    if (!ended)
+        fprintf(out, "    PC = 0x%03X;\n", addr);
+
+    fprintf(out, "}\n\n");
+
+    /* where a final skip lands depends on the instruction it skips */
+    *end = addr;
+    if (ended && isSkip(readOpcode(chip8, addr - 2)))
+        *end = SDL_min(addr + 2, AMOUNT_MEMORY_BYTES - 1);
+    return length;
+}
+
+static int
+writeSource(const emulator *chip8, const char *path)
+{
+    static uint8_t  reached[AMOUNT_MEMORY_BYTES];
+    static uint8_t  leaders[AMOUNT_MEMORY_BYTES];
+    static uint16_t lengths[AMOUNT_MEMORY_BYTES];
+    static uint16_t ends[AMOUNT_MEMORY_BYTES];
+    char            abi[AOT_ABI_LEN];
+    int             count = 0;
+
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        SDL_LogError(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "failed to open %s: %s\n",
+            path,
+            strerror(errno)
+        );
+        return -1;
+    }
+
+    memset(reached, 0, sizeof reached);
+    memset(leaders, 0, sizeof leaders);
+    memset(lengths, 0, sizeof lengths);
+    findReachable(chip8, reached, leaders);
+    getAbi(abi, sizeof abi);
+
+    fprintf(
+        out,
+        "/* generated by teal8 --aot, do not edit */\n"
+        "#include <stdint.h>\n\n"
+        "typedef struct {\n"
+        "    uint16_t start;\n"
+        "    uint16_t end;\n"
+        "    uint16_t length;\n"
+        "    void (*run)(uint8_t *chip8);\n"
+        "} aotBlock;\n\n"
+        "#define MEM(a)      ((c + %zu)[(a)])\n"
+        "#define V(r)        ((c + %zu)[(r)])\n"
+        "#define I           (*(uint16_t *)(c + %zu))\n"
+        "#define PC          (*(uint16_t *)(c + %zu))\n"
+        "#define SPEC        (*(uint8_t *)(c + %zu))\n"
+        "#define DELAY       (*(uint8_t *)(c + %zu))\n"
+        "#define STACK(n)    (((uint16_t *)(c + %zu))[(n)])\n"
+        "#define SP          (*(uint8_t *)(c + %zu))\n"
+        "#define KEY(k)      (((int *)(c + %zu))[(k)])\n\n",
+        offsetof(emulator, memory),
+        offsetof(emulator, v),
+        offsetof(emulator, i),
+        offsetof(emulator, pc),
+        offsetof(emulator, specType),
+        offsetof(emulator, timers.delay),
+        offsetof(emulator, stack.s),
+        offsetof(emulator, stack.sp),
+        offsetof(emulator, display.keyDown)
+    );
+
+    for (int addr = 0; addr < AMOUNT_MEMORY_BYTES - 1; addr++) {
+        if (!leaders[addr] || !reached[addr])
+            continue;
+        lengths[addr] = emitBlock(out, chip8, addr, &ends[addr]);
+        if (lengths[addr] > 0)
+            count++;
+    }
+
+    fprintf(out, "const aotBlock teal8_aot_blocks[] = {\n");
+    for (int addr = 0; addr < AMOUNT_MEMORY_BYTES - 1; addr++)
+        if (lengths[addr] > 0)
+            fprintf(
+                out,
+                "    { 0x%03X, 0x%03X, %d, b%03X },\n",
+                addr,
+                ends[addr],
+                lengths[addr],
+                addr
+            );
+    if (count == 0)
+        fprintf(out, "    { 0, 0, 0, 0 },\n");
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "const int teal8_aot_block_count = %d;\n\n", count);
+    fprintf(out, "const char teal8_aot_abi[] = \"%s\";\n", abi);
+
+    if (fclose(out) != 0) {
+        SDL_LogError(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "failed to write %s\n",
+            path
+        );
+        return -1;
+    }
+
+    SDL_LogDebug(
+        SDL_LOG_CATEGORY_APPLICATION,
+        "emitted %d blocks to %s\n",
+        count,
+        path
+    );
+
+    return 0;
+}
+
+/* build the generated source with the system compiler */
+static int
+runCompiler(const char *source, const char *output)
+{
+    char *const argv[] = {
+        "cc",
+        "-O2",
+        "-shared",
+        "-fPIC",
+        "-fno-strict-aliasing",
+        "-w",
+        "-o",
+        (char *)output,
+        (char *)source,
+        NULL
+    };
+    pid_t   pid;
+    int     status;
+
+    if (posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ) != 0) {
+        SDL_LogError(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "failed to run the system compiler\n"
+        );
+        return -1;
+    }
+
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        SDL_LogError(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "failed to compile %s\n",
+            source
+        );
+        return -1;
+    }
+
+    return 0;
+}
+
+char *
+getAotCachePath(const char *hash)
+{
+    const char  *xdg    = getenv("XDG_CACHE_HOME");
+    const char  *home   = getenv("HOME");
+    char        *path   = malloc(sizeof(char) * PATH_MAX);
+
+    if (path == NULL) {
+        SDL_LogError(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "failed to allocate memory for cache path\n"
+        );
+        return NULL;
+    }
+
+    if (xdg != NULL && xdg[0] != '\0') {
+        snprintf(path, PATH_MAX, "%s", xdg);
+        mkdir(path, 0755);
+    } else if (home != NULL) {
+        snprintf(path, PATH_MAX, "%s/.cache", home);
+        mkdir(path, 0755);
+    } else {
+        SDL_LogError(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "no cache directory available\n"
+        );
+        free(path);
+        return NULL;
+    }
+
+    strncat(path, "/teal8", PATH_MAX - strlen(path) - 1);
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        SDL_LogError(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "failed to create cache directory %s\n",
+            path
+        );
+        free(path);
+        return NULL;
+    }
+
+    const size_t len = strlen(path);
+    snprintf(path + len, PATH_MAX - len, "/%s.so", hash);
+
+    return path;
+}
+
+int
+compileAot(const emulator *chip8, const char *output)
+{
+    char source[PATH_MAX];
+    char temporary[PATH_MAX];
+
+    /*
+     * build next to the output under names of this process and move the result in whole,
+     * so another instance never loads a half-written object and a failed build leaves nothing
+     */
+    snprintf(source, sizeof source, "%s.%d.c", output, (int)getpid());
+    snprintf(temporary, sizeof temporary, "%s.%d.tmp", output, (int)getpid());
+
+    if (writeSource(chip8, source) != 0) {
+        remove(source);
+        return -1;
+    }
+
+    int result = runCompiler(source, temporary);
+    remove(source);
+
+    if (result == 0 && rename(temporary, output) != 0) {
+        SDL_LogError(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "failed to move the compiled ROM to %s\n",
+            output
+        );
+        result = -1;
+    }
+
+    if (result != 0)
+        remove(temporary);
+
+    return result;
+}
+
+aot *
+openAot(const emulator *chip8, const char *hash)
+{
+    char *path = getAotCachePath(hash);
+    if (path == NULL)
+        return NULL;
+
+    aot *aot = loadAot(path);
+    if (aot == NULL) {
+        SDL_LogInfo(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "compiling ROM to %s\n",
+            path
+        );
+        if (compileAot(chip8, path) == 0)
+            aot = loadAot(path);
+    }
+
+    free(path);
+    return aot;
+}
+
+aot *
+loadAot(const char *path)
+{
+    char abi[AOT_ABI_LEN];
+
+    aot *aot = malloc(sizeof *aot);
+    if (aot == NULL) {
+        SDL_LogError(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "failed to allocate memory for compiled ROM\n"
+        );
+        return NULL;
+    }
+
+    aot->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (aot->handle == NULL) {
+        SDL_LogDebug(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "failed to load %s: %s\n",
+            path,
+            dlerror()
+        );
+        free(aot);
+        return NULL;
+    }
+
+    const char  *moduleAbi  = dlsym(aot->handle, "teal8_aot_abi");
+    const int   *count      = dlsym(aot->handle, "teal8_aot_block_count");
+    aot->blocks             = dlsym(aot->handle, "teal8_aot_blocks");
+
+    getAbi(abi, sizeof abi);
+    if (moduleAbi == NULL || count == NULL || aot->blocks == NULL || strcmp(moduleAbi, abi) != 0) {
+        SDL_LogDebug(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "%s was built for a different emulator layout\n",
+            path
+        );
+        dlclose(aot->handle);
+        free(aot);
+        return NULL;
+    }
+
+    aot->count = *count;
+    resetAot(aot);
+
+    return aot;
+}
+
+void
+unloadAot(aot *aot)
+{
+    if (aot == NULL)
+        return;
+
+    dlclose(aot->handle);
+    free(aot);
+}
+
+void
+resetAot(aot *aot)
+{
+    memset(aot->entries, 0, sizeof aot->entries);
+    memset(aot->covered, 0, sizeof aot->covered);
+
+    for (int i = 0; i < aot->count; i++) {
+        const aotBlock *block = &aot->blocks[i];
+        aot->entries[block->start] = block;
+        for (int addr = block->start; addr < block->end; addr++)
+            aot->covered[addr] = 1;
+    }
+}
+
+void
+invalidateAot(aot *aot, const uint16_t address)
+{
+    if (address >= AMOUNT_MEMORY_BYTES || !aot->covered[address])
+        return;
+
+    /* compiled code no longer matches memory, so interpret it from now on */
+    for (int i = 0; i < aot->count; i++) {
+        const aotBlock *block = &aot->blocks[i];
+        if (address >= block->start && address < block->end)
+            aot->entries[block->start] = NULL;
+    }
+}
+
+int
+runAot(emulator *chip8, const int budget)
+{
+    aot *aot        = chip8->aot;
+    int remaining   = budget;
+
+    while (remaining > 0) {
+        if (isIdle(chip8))
+            break;
+
+        const aotBlock *block = NULL;
+        if (chip8->pc < AMOUNT_MEMORY_BYTES)
+            block = aot->entries[chip8->pc];
+
+        if (block == NULL || block->length > remaining) {
+            remaining -= runThreaded(chip8, 1);
+            if (hostNeeded(chip8))
+                break;
+            continue;
+        }
+
+        block->run((uint8_t *)chip8);
+        remaining -= block->length;
+    }
+
+    return budget - remaining;
+}
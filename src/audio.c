@@ -1,5 +1,6 @@
 #include <time.h>
 #include <math.h>
+#include <string.h>
 
 #include <SDL.h>
 
@@ -7,27 +8,205 @@
 
 #define AUDIO_TONE_FREQ     440
 #define AUDIO_VOLUME        1000
-#define AUDIO_SAMPLE_RATE   44100
 #define AUDIO_BUFFER_SIZE   512
+#define AUDIO_PHASE_SHIFT   25          // the top 7 of the 32 phase bits select a pattern bit
+#define AUDIO_PATTERN_RATE  4000.0      // pattern bits per second at the default pitch
+#define AUDIO_DEFAULT_PITCH 64
+#define AUDIO_WAV_HEADER    44          // bytes before the samples of a WAV file
+
+/*
+ * Get the phase increment that plays a pattern at a rate.
+ *
+ * Parameter:
+ * the rate in pattern bits per second
+ *
+ * Return:
+ * the phase increment per output sample
+ */
+static uint32_t
+getStep(const double bitsPerSecond)
+{
+    return (uint32_t)(bitsPerSecond * (1 << AUDIO_PHASE_SHIFT) / AUDIO_SAMPLE_RATE + 0.5);
+}
+
+/*
+ * Get the phase increment that plays a pattern at an XO-CHIP pitch.
+ */
+static uint32_t
+getPitchStep(const uint8_t pitch)
+{
+    return getStep(AUDIO_PATTERN_RATE * pow(2.0, (pitch - AUDIO_DEFAULT_PITCH) / 48.0));
+}
+
+/*
+ * Put samples in the ring for the callback.
+ * Samples beyond the latency target are dropped rather than delaying the sound further,
+ * and a drained ring gets a buffer of silence first so the next callback has enough.
+ */
+static void
+queueSamples(audio *audio, const Sint16 *samples, const int count)
+{
+    const unsigned  tail = atomic_load_explicit(&audio->tail, memory_order_acquire);
+    unsigned        head = atomic_load_explicit(&audio->head, memory_order_relaxed);
+
+    if (head == tail) {
+        for (int i = 0; i < AUDIO_BUFFER_SIZE; i++)
+            audio->ring[head++ & (AUDIO_RING_SAMPLES - 1)] = 0;
+    }
+
+    for (int i = 0; i < count && head - tail < AUDIO_LATENCY; i++)
+        audio->ring[head++ & (AUDIO_RING_SAMPLES - 1)] = samples[i];
+
+    atomic_store_explicit(&audio->head, head, memory_order_release);
+}
+
+static void
+writeLittleEndian(FILE *file, const uint32_t value, const int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        fputc((value >> (8 * i)) & 0xFF, file);
+}
+
+/*
+ * Write the WAV header for a number of mono 16-bit samples.
+ */
+static void
+writeWavHeader(FILE *file, const uint32_t samples)
+{
+    const uint32_t dataBytes = samples * sizeof(Sint16);
+
+    fwrite("RIFF", 1, 4, file);
+    writeLittleEndian(file, AUDIO_WAV_HEADER - 8 + dataBytes, 4);
+    fwrite("WAVEfmt ", 1, 8, file);
+    writeLittleEndian(file, 16, 4);                             // format chunk size
+    writeLittleEndian(file, 1, 2);                              // PCM
+    writeLittleEndian(file, 1, 2);                              // mono
+    writeLittleEndian(file, AUDIO_SAMPLE_RATE, 4);
+    writeLittleEndian(file, AUDIO_SAMPLE_RATE * sizeof(Sint16), 4);
+    writeLittleEndian(file, sizeof(Sint16), 2);                 // block align
+    writeLittleEndian(file, 16, 2);                             // bits per sample
+    fwrite("data", 1, 4, file);
+    writeLittleEndian(file, dataBytes, 4);
+}
 
 void
 audioCallback(void *userdata, Uint8 *stream, const int len)
 {
     audio           *aud            = (audio *)userdata;
     Sint16          *samples        = (Sint16 *)stream;
-    const double    phaseIncrement  = 2 * M_PI * AUDIO_TONE_FREQ / AUDIO_SAMPLE_RATE;
     const int       sampleCount     = len / sizeof(Sint16);
+    const unsigned  head            = atomic_load_explicit(&aud->head, memory_order_acquire);
+    unsigned        tail            = atomic_load_explicit(&aud->tail, memory_order_relaxed);
+    int             i               = 0;
+
+    for (; i < sampleCount && tail != head; i++)
+        samples[i] = aud->ring[tail++ & (AUDIO_RING_SAMPLES - 1)];
+
+    /* the emulator fell behind, play silence instead of waiting */
+    for (; i < sampleCount; i++)
+        samples[i] = 0;
+
+    atomic_store_explicit(&aud->tail, tail, memory_order_release);
+}
+
+void
+resetAudio(audio *audio)
+{
+    /* a square wave, one period per pattern at the default beep frequency */
+    memset(audio->pattern, 0xFF, AUDIO_PATTERN_BYTES / 2);
+    memset(audio->pattern + AUDIO_PATTERN_BYTES / 2, 0x00, AUDIO_PATTERN_BYTES / 2);
+    audio->pitch    = AUDIO_DEFAULT_PITCH;
+    audio->step     = getStep(AUDIO_TONE_FREQ * AUDIO_PATTERN_BITS);
+    audio->pending  = SDL_TRUE;
+}
+
+void
+setAudioPattern(audio *audio, const uint8_t *pattern)
+{
+    memcpy(audio->pattern, pattern, AUDIO_PATTERN_BYTES);
+    audio->step     = getPitchStep(audio->pitch);
+    audio->pending  = SDL_TRUE;
+}
+
+void
+setAudioPitch(audio *audio, const uint8_t pitch)
+{
+    audio->pitch    = pitch;
+    audio->step     = getPitchStep(pitch);
+    audio->pending  = SDL_TRUE;
+}
+
+void
+streamAudio(audio *audio, const int samples, const SDL_bool playing)
+{
+    Sint16  chunk[AUDIO_BUFFER_SIZE];
+    int     left = samples;
 
-    for (int i = 0; i < sampleCount; ++i) {
-        /* square wave for beep tone */
-        samples[i] = sin(aud->phase) > 0 ? AUDIO_VOLUME : -AUDIO_VOLUME;
-        aud->phase += phaseIncrement;
-        if (aud->phase >= 2.0 * M_PI) {
-            aud->phase -= 2.0 * M_PI;
+    /* nobody listens, only keep up with the program's changes */
+    if (!audio->poweredOn && audio->wav == NULL)
+        left = 0;
+
+    while (left > 0) {
+        const int count = left < AUDIO_BUFFER_SIZE ? left : AUDIO_BUFFER_SIZE;
+
+        if (playing) {
+            for (int i = 0; i < count; i++) {
+                chunk[i]        = audio->levels[audio->phase >> AUDIO_PHASE_SHIFT];
+                audio->phase   += audio->playingStep;
+            }
+        } else {
+            /* the next beep starts at the beginning of the pattern */
+            memset(chunk, 0, count * sizeof *chunk);
+            audio->phase = 0;
+        }
+
+        if (audio->poweredOn)
+            queueSamples(audio, chunk, count);
+
+        if (audio->wav != NULL) {
+            for (int i = 0; i < count; i++)
+                writeLittleEndian(audio->wav, (uint16_t)chunk[i], 2);
+            audio->wavSamples += count;
         }
+
+        left -= count;
+    }
+
+    /* the program's changes apply from here, expand the pattern once rather than per sample */
+    if (audio->pending) {
+        for (int bit = 0; bit < AUDIO_PATTERN_BITS; bit++)
+            audio->levels[bit] = audio->pattern[bit / 8] & (0x80 >> (bit % 8)) ? AUDIO_VOLUME : -AUDIO_VOLUME;
+        audio->playingStep  = audio->step;
+        audio->pending      = SDL_FALSE;
     }
 }
 
+int
+startRecording(audio *audio, const char *path)
+{
+    audio->wav = fopen(path, "wb");
+    if (audio->wav == NULL)
+        return -1;
+
+    /* the sizes are filled in once the recording stops */
+    audio->wavSamples = 0;
+    writeWavHeader(audio->wav, 0);
+
+    return 0;
+}
+
+void
+stopRecording(audio *audio)
+{
+    if (audio->wav == NULL)
+        return;
+
+    rewind(audio->wav);
+    writeWavHeader(audio->wav, audio->wavSamples);
+    fclose(audio->wav);
+    audio->wav = NULL;
+}
+
 int
 initAudio(audio *audio)
 {
@@ -36,6 +215,9 @@ initAudio(audio *audio)
         return -1;
     }
 
+    atomic_store(&audio->head, 0);
+    atomic_store(&audio->tail, 0);
+
     SDL_zero(audio->spec);
     audio->spec.freq        = AUDIO_SAMPLE_RATE;
     audio->spec.format      = AUDIO_S16SYS;
@@ -51,8 +233,9 @@ initAudio(audio *audio)
     }
 
     audio->poweredOn        = SDL_TRUE;
-    audio->playing          = SDL_FALSE;
-    audio->phase            = 0.0;
+
+    /* run the device until it is closed, silence is queued like any other sound */
+    SDL_PauseAudioDevice(audio->deviceId, 0);
 
     return 0;
 }
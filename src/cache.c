@@ -0,0 +1,726 @@
+#include <string.h>
+
+#include "../include/emulator.h"
+#include "../include/fusion.h"
+
+static void
+opFallback(emulator *chip8, const instruction *ins)
+{
+    decodeAndExecuteOpcode(chip8, ins->opcode);
+}
+
+static void
+op00EE(emulator *chip8, const instruction *ins)
+{
+    /* return from subroutine */
+    stackPop(&chip8->stack, &chip8->pc);
+}
+
+static void
+op1NNN(emulator *chip8, const instruction *ins)
+{
+    /* jump to address NNN */
+    chip8->pc = ins->nnn;
+}
+
+static void
+op2NNN(emulator *chip8, const instruction *ins)
+{
+    /* call subroutine at address NNN */
+    stackPush(&chip8->stack, &chip8->pc);
+    chip8->pc = ins->nnn;
+}
+
+static void
+op3XNN(emulator *chip8, const instruction *ins)
+{
+    /* skip next instruction if Vx == NN */
+    if (chip8->v[ins->x] == ins->nn)
+        chip8->pc += ins->skip;
+}
+
+static void
+op4XNN(emulator *chip8, const instruction *ins)
+{
+    /* skip next instruction if Vx != NN */
+    if (chip8->v[ins->x] != ins->nn)
+        chip8->pc += ins->skip;
+}
+
+static void
+op5XY0(emulator *chip8, const instruction *ins)
+{
+    /* skip next instruction if Vx == Vy */
+    if (chip8->v[ins->x] == chip8->v[ins->y])
+        chip8->pc += ins->skip;
+}
+
+static void
+op6XNN(emulator *chip8, const instruction *ins)
+{
+    /* set Vx to NN */
+    chip8->v[ins->x] = ins->nn;
+}
+
+static void
+op7XNN(emulator *chip8, const instruction *ins)
+{
+    /* add NN to Vx */
+    chip8->v[ins->x] += ins->nn;
+}
+
+static void
+op8XY0(emulator *chip8, const instruction *ins)
+{
+    /* set Vx to Vy */
+    chip8->v[ins->x] = chip8->v[ins->y];
+}
+
+static void
+op8XY1(emulator *chip8, const instruction *ins)
+{
+    /* set Vx to Vx OR Vy; reset VF to 0 */
+    chip8->v[ins->x] |= chip8->v[ins->y];
+    if (chip8->specType == CHIP8)
+        chip8->v[0xF] = 0;
+}
+
+static void
+op8XY2(emulator *chip8, const instruction *ins)
+{
+    /* set Vx to Vx AND Vy; reset VF to 0 */
+    chip8->v[ins->x] &= chip8->v[ins->y];
+    if (chip8->specType == CHIP8)
+        chip8->v[0xF] = 0;
+}
+
+static void
+op8XY3(emulator *chip8, const instruction *ins)
+{
+    /* set Vx to Vx XOR Vy; reset VF to 0 */
+    chip8->v[ins->x] ^= chip8->v[ins->y];
+    if (chip8->specType == CHIP8)
+        chip8->v[0xF] = 0;
+}
+
+static void
+op8XY4(emulator *chip8, const instruction *ins)
+{
+    /* add Vy to Vx; set VF to 1 if there is a carry */
+    const uint8_t operand   = chip8->v[ins->x];
+    const uint8_t addend    = chip8->v[ins->y];
+    chip8->v[ins->x] += addend;
+    chip8->v[0xF] = operand > 0xFF - addend;
+}
+
+static void
+op8XY5(emulator *chip8, const instruction *ins)
+{
+    /* subtract Vy from Vx; set VF to 0 if there is a borrow */
+    const uint8_t minuend       = chip8->v[ins->x];
+    const uint8_t subtrahend    = chip8->v[ins->y];
+    chip8->v[ins->x] = minuend - subtrahend;
+    chip8->v[0xF] = minuend >= subtrahend;
+}
+
+static void
+op8XY6(emulator *chip8, const instruction *ins)
+{
+    /* shift Vx right by 1; set VF to the bit shifted out */
+    const uint8_t operand = chip8->v[ins->x];
+    if (chip8->specType != SCHIP)
+        chip8->v[ins->x] = chip8->v[ins->y];
+    chip8->v[ins->x] >>= 1;
+    chip8->v[0xF] = operand & 0x01;
+}
+
+static void
+op8XY7(emulator *chip8, const instruction *ins)
+{
+    /* set Vx to Vy - Vx; set VF to 0 if there is a borrow */
+    const uint8_t minuend       = chip8->v[ins->y];
+    const uint8_t subtrahend    = chip8->v[ins->x];
+    chip8->v[ins->x] = minuend - subtrahend;
+    chip8->v[0xF] = minuend >= subtrahend;
+}
+
+static void
+op8XYE(emulator *chip8, const instruction *ins)
+{
+    /* shift Vx left by 1; set VF to the bit shifted out */
+    const uint8_t operand = chip8->v[ins->x];
+    if (chip8->specType != SCHIP)
+        chip8->v[ins->x] = chip8->v[ins->y];
+    chip8->v[ins->x] <<= 1;
+    chip8->v[0xF] = operand >> 7;
+}
+
+static void
+op9XY0(emulator *chip8, const instruction *ins)
+{
+    /* skip next instruction if Vx != Vy */
+    if (chip8->v[ins->x] != chip8->v[ins->y])
+        chip8->pc += ins->skip;
+}
+
+static void
+opANNN(emulator *chip8, const instruction *ins)
+{
+    /* set I to address NNN */
+    chip8->i = ins->nnn;
+}
+
+static void
+opBNNN(emulator *chip8, const instruction *ins)
+{
+    /* jump to address NNN + V0; on SCHIP, jump to XNN + vX */
+    if (chip8->specType != SCHIP)
+        chip8->pc = ins->nnn + chip8->v[0];
+    else
+        chip8->pc = ins->nnn + chip8->v[ins->x];
+}
+
+static void
+opCXNN(emulator *chip8, const instruction *ins)
+{
+    /* set Vx to a random number AND NN */
+    chip8->v[ins->x] = randomNumber(0, 255) & ins->nn;
+}
+
+static void
+opEX9E(emulator *chip8, const instruction *ins)
+{
+    /* skip next instruction if key with the value of Vx is pressed */
+    if (chip8->display.keyDown[chip8->v[ins->x]])
+        chip8->pc += ins->skip;
+}
+
+static void
+opEXA1(emulator *chip8, const instruction *ins)
+{
+    /* skip next instruction if key with the value of Vx is not pressed */
+    if (!chip8->display.keyDown[chip8->v[ins->x]])
+        chip8->pc += ins->skip;
+}
+
+static void
+opFX07(emulator *chip8, const instruction *ins)
+{
+    /* set Vx to the value of the delay timer */
+    chip8->v[ins->x] = chip8->timers.delay;
+}
+
+static void
+opFX15(emulator *chip8, const instruction *ins)
+{
+    /* set the delay timer to Vx */
+    chip8->timers.delay = chip8->v[ins->x];
+}
+
+static void
+opFX1E(emulator *chip8, const instruction *ins)
+{
+    /* add Vx to I */
+    chip8->i += chip8->v[ins->x];
+}
+
+static void
+opFX29(emulator *chip8, const instruction *ins)
+{
+    /* set I to the location of the sprite for the character in Vx */
+    chip8->i = (chip8->v[ins->x] & 0x0F) * 5;
+}
+
+static void
+opFX33(emulator *chip8, const instruction *ins)
+{
+    /* store the BCD representation of Vx in memory at I, I+1 and I+2 */
+    const uint8_t value = chip8->v[ins->x];
+    writeMemory(chip8, chip8->i, value / 100);
+    writeMemory(chip8, chip8->i + 1, (value / 10) % 10);
+    writeMemory(chip8, chip8->i + 2, value % 10);
+}
+
+static void
+opFX55(emulator *chip8, const instruction *ins)
+{
+    /* store V0 to Vx in memory starting at address I */
+    const uint8_t x = ins->x;
+    for (int i = 0; i <= x; i++)
+        writeMemory(chip8, chip8->i + i, chip8->v[i]);
+    if (chip8->specType != SCHIP)
+        chip8->i += x + 1;
+}
+
+static void
+opFX65(emulator *chip8, const instruction *ins)
+{
+    /* fill V0 to Vx with values from memory starting at address I */
+    for (int i = 0; i <= ins->x; i++) {
+        if (chip8->i + i < AMOUNT_MEMORY_BYTES)
+            chip8->v[i] = chip8->memory[chip8->i + i];
+    }
+    if (chip8->specType != SCHIP)
+        chip8->i += ins->x + 1;
+}
+
+/* every opcode form with its handler, in dispatch table order */
+static const opcodeHandler handlers[] = {
+#define X(form, handler) handler,
+    OPCODE_FORMS(X)
+#undef X
+};
+
+static uint8_t
+selectForm(const uint16_t opcode)
+{
+    switch (opcode >> 12) {
+        case 0x0:
+            return opcode == 0x00EE ? FORM_00EE : FORM_FALLBACK;
+        case 0x1:
+            return FORM_1NNN;
+        case 0x2:
+            return FORM_2NNN;
+        case 0x3:
+            return FORM_3XNN;
+        case 0x4:
+            return FORM_4XNN;
+        case 0x5:
+            return (opcode & 0x000F) == 0x0 ? FORM_5XY0 : FORM_FALLBACK;
+        case 0x6:
+            return FORM_6XNN;
+        case 0x7:
+            return FORM_7XNN;
+        case 0x8:
+            switch (opcode & 0x000F) {
+                case 0x0: return FORM_8XY0;
+                case 0x1: return FORM_8XY1;
+                case 0x2: return FORM_8XY2;
+                case 0x3: return FORM_8XY3;
+                case 0x4: return FORM_8XY4;
+                case 0x5: return FORM_8XY5;
+                case 0x6: return FORM_8XY6;
+                case 0x7: return FORM_8XY7;
+                case 0xE: return FORM_8XYE;
+            }
+            break;
+        case 0x9:
+            return FORM_9XY0;
+        case 0xA:
+            return FORM_ANNN;
+        case 0xB:
+            return FORM_BNNN;
+        case 0xC:
+            return FORM_CXNN;
+        case 0xE:
+            switch (opcode & 0x00FF) {
+                case 0x9E: return FORM_EX9E;
+                case 0xA1: return FORM_EXA1;
+            }
+            break;
+        case 0xF:
+            switch (opcode & 0x00FF) {
+                case 0x07: return FORM_FX07;
+                case 0x15: return FORM_FX15;
+                case 0x1E: return FORM_FX1E;
+                case 0x29: return FORM_FX29;
+                case 0x33: return FORM_FX33;
+                case 0x55: return FORM_FX55;
+                case 0x65: return FORM_FX65;
+            }
+            break;
+    }
+
+    /*
+     * display, key wait, sound timer, SCHIP and XO-CHIP opcodes
+     * go through the reference decoder
+     */
+    return FORM_FALLBACK;
+}
+
+/*
+ * Fused handlers run the members of a group back to back
+ * and stop as soon as one of them transfers control elsewhere.
+ * They return the number of instructions executed.
+ */
+typedef int (*fusedHandler)(emulator *chip8, const instruction *ins);
+
+#define FUSED_STEP(form, k)                                         \
+    do {                                                            \
+        const uint16_t next = chip8->pc + 2;                        \
+        chip8->pc = next;                                           \
+        op##form(chip8, ins + 2 * (k));                             \
+        if (chip8->pc != next)                                      \
+            return (k) + 1;                                         \
+    } while (0)
+
+#define X(a, b)                                                     \
+    static int                                                      \
+    fused##a##_##b(emulator *chip8, const instruction *ins)         \
+    {                                                               \
+        FUSED_STEP(a, 0);                                           \
+        chip8->pc += 2;                                             \
+        op##b(chip8, ins + 2);                                      \
+        return 2;                                                   \
+    }
+FUSED_PAIRS(X)
+#undef X
+
+#define X(a, b, c)                                                  \
+    static int                                                      \
+    fused##a##_##b##_##c(emulator *chip8, const instruction *ins)   \
+    {                                                               \
+        FUSED_STEP(a, 0);                                           \
+        FUSED_STEP(b, 1);                                           \
+        chip8->pc += 2;                                             \
+        op##c(chip8, ins + 4);                                      \
+        return 3;                                                   \
+    }
+FUSED_TRIPLES(X)
+#undef X
+
+#undef FUSED_STEP
+
+enum {
+    FUSED_UNKNOWN,                          // not matched since decoding
+    FUSED_NONE,                             // no group starts here
+#define X(a, b) FUSED_##a##_##b,
+    FUSED_PAIRS(X)
+#undef X
+#define X(a, b, c) FUSED_##a##_##b##_##c,
+    FUSED_TRIPLES(X)
+#undef X
+    FUSED_COUNT,
+    FUSED_IDLE = FUSED_COUNT                // heads an idle loop, checked before it runs
+};
+
+#define FUSED_FIRST (FUSED_NONE + 1)
+
+static const struct {
+    fusedHandler    handler;
+    uint8_t         length;
+    uint8_t         forms[FUSED_MAX_LENGTH];
+} fusedGroups[] = {
+    {NULL, 0, {0}},
+    {NULL, 0, {0}},
+#define X(a, b) {fused##a##_##b, 2, {FORM_##a, FORM_##b}},
+    FUSED_PAIRS(X)
+#undef X
+#define X(a, b, c) {fused##a##_##b##_##c, 3, {FORM_##a, FORM_##b, FORM_##c}},
+    FUSED_TRIPLES(X)
+#undef X
+};
+
+/*
+ * Decode the instruction at an address into the cache,
+ * with the skip length of the instruction after it.
+ */
+static void
+decodeAddress(emulator *chip8, const uint16_t address)
+{
+    instruction *ins = &chip8->cache[address];
+
+    decodeInstruction(ins, (chip8->memory[address] << 8) | chip8->memory[address + 1]);
+    ins->skip = getSkipLength(chip8, address + 2);
+}
+
+/*
+ * Decode the instruction at an address if needed and
+ * record the longest fused group starting there.
+ */
+static void
+fuseInstruction(emulator *chip8, const uint16_t address)
+{
+    instruction *ins = &chip8->cache[address];
+
+    if (ins->handler == NULL)
+        decodeAddress(chip8, address);
+    ins->fused = FUSED_NONE;
+
+    /* an idle loop is looked at before it runs, so it is neither fused nor fused into */
+    if (isIdleLoop(chip8, address)) {
+        ins->fused = FUSED_IDLE;
+        return;
+    }
+
+    /* triples come last, so searching backwards prefers them */
+    for (int group = FUSED_COUNT - 1; group >= FUSED_FIRST; group--) {
+        const int length = fusedGroups[group].length;
+        int       k;
+
+        if (address + 2 * length > AMOUNT_MEMORY_BYTES)
+            continue;
+
+        for (k = 0; k < length; k++) {
+            const uint16_t  memberAddress   = address + 2 * k;
+            instruction     *member         = &chip8->cache[memberAddress];
+
+            if (member->handler == NULL)
+                decodeAddress(chip8, memberAddress);
+            if (member->form != fusedGroups[group].forms[k])
+                break;
+            if (k > 0 && isIdleLoop(chip8, memberAddress))
+                break;
+        }
+
+        if (k == length) {
+            ins->fused = group;
+            return;
+        }
+    }
+}
+
+void
+decodeInstruction(instruction *ins, const uint16_t opcode)
+{
+    ins->opcode     = opcode;
+    ins->x          = (opcode & 0x0F00) >> 8;
+    ins->y          = (opcode & 0x00F0) >> 4;
+    ins->n          = opcode & 0x000F;
+    ins->nn         = opcode & 0x00FF;
+    ins->nnn        = opcode & 0x0FFF;
+    ins->form       = selectForm(opcode);
+    ins->handler    = handlers[ins->form];
+    ins->fused      = FUSED_UNKNOWN;
+    ins->skip       = 2;
+}
+
+void
+clearCache(instruction *cache)
+{
+    memset(cache, 0, AMOUNT_MEMORY_BYTES * sizeof *cache);
+}
+
+void
+invalidateCache(instruction *cache, const uint16_t address)
+{
+    if (address >= AMOUNT_MEMORY_BYTES)
+        return;
+
+    /* the longest fused group starts 2 * FUSED_MAX_LENGTH - 1 bytes back, a skip 3 bytes back */
+    for (int i = 0; i < 2 * FUSED_MAX_LENGTH && i <= address; i++) {
+        cache[address - i].handler  = NULL;
+        cache[address - i].fused    = FUSED_UNKNOWN;
+    }
+}
+
+/*
+ * Check whether a predecoded engine has to return after the reference decoder ran.
+ * The skip lengths in the cache follow the spec, so a program
+ * that just changed its spec has to leave for the cache to be synced.
+ */
+static SDL_bool
+leaveEngine(const emulator *chip8)
+{
+    return hostNeeded(chip8) || chip8->specType != chip8->cacheSpecType;
+}
+
+/* decode everything again once the spec the cache was decoded for changed */
+static void
+syncCache(emulator *chip8)
+{
+    if (chip8->cacheSpecType != chip8->specType) {
+        clearCache(chip8->cache);
+        chip8->cacheSpecType = chip8->specType;
+    }
+}
+
+void
+executeCachedInstruction(emulator *chip8)
+{
+    /* let the reference path report an out of bounds program counter */
+    if (chip8->pc >= AMOUNT_MEMORY_BYTES - 1) {
+        const uint16_t opcode = fetchOpcode(chip8);
+        chip8->pc += 2;
+        decodeAndExecuteOpcode(chip8, opcode);
+        return;
+    }
+
+    instruction *ins = &chip8->cache[chip8->pc];
+    if (ins->handler == NULL)
+        decodeAddress(chip8, chip8->pc);
+
+    chip8->pc += 2;
+    ins->handler(chip8, ins);
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+
+int
+runThreaded(emulator *chip8, const int budget)
+{
+    static const void *labels[] = {
+#define X(form, handler) &&label##form,
+        OPCODE_FORMS(X)
+#undef X
+    };
+    static const void *fusedLabels[] = {
+#define X(a, b) &&fusedLabel##a##_##b,
+        FUSED_PAIRS(X)
+#undef X
+#define X(a, b, c) &&fusedLabel##a##_##b##_##c,
+        FUSED_TRIPLES(X)
+#undef X
+        &&idleLoop                          // FUSED_IDLE, also keeps the table non-empty
+    };
+
+    instruction *ins;
+    int         executed = 0;
+
+    syncCache(chip8);
+
+/* fetch the next predecoded instruction and jump straight to its handler */
+#define DISPATCH()                                                  \
+    do {                                                            \
+        if (executed >= budget)                                     \
+            return executed;                                        \
+        if (chip8->pc >= AMOUNT_MEMORY_BYTES - 1)                   \
+            goto outOfBounds;                                       \
+        ins = &chip8->cache[chip8->pc];                             \
+        if (ins->fused == FUSED_UNKNOWN)                            \
+            fuseInstruction(chip8, chip8->pc);                      \
+        if (                                                        \
+            ins->fused != FUSED_NONE                                \
+            &&                                                      \
+            (                                                       \
+                budget - executed >= FUSED_MAX_LENGTH               \
+                ||                                                  \
+                ins->fused == FUSED_IDLE                            \
+            )                                                       \
+        )                                                           \
+            goto *fusedLabels[ins->fused - FUSED_FIRST];            \
+        chip8->pc += 2;                                             \
+        executed++;                                                 \
+        goto *labels[ins->form];                                    \
+    } while (0)
+
+    DISPATCH();
+
+#define X(a, b)                                                     \
+    fusedLabel##a##_##b:                                            \
+        executed += fused##a##_##b(chip8, ins);                     \
+        DISPATCH();
+    FUSED_PAIRS(X)
+#undef X
+
+#define X(a, b, c)                                                  \
+    fusedLabel##a##_##b##_##c:                                      \
+        executed += fused##a##_##b##_##c(chip8, ins);               \
+        DISPATCH();
+    FUSED_TRIPLES(X)
+#undef X
+
+#define X(form, handler)                                            \
+    label##form:                                                    \
+        handler(chip8, ins);                                        \
+        if (FORM_##form == FORM_FALLBACK && leaveEngine(chip8))     \
+            return executed;                                        \
+        DISPATCH();
+    OPCODE_FORMS(X)
+#undef X
+
+idleLoop:
+    if (isIdle(chip8))
+        return executed;
+    chip8->pc += 2;
+    executed++;
+    goto *labels[ins->form];
+
+outOfBounds:
+    executeCachedInstruction(chip8);
+    executed++;
+    if (hostNeeded(chip8))
+        return executed;
+    DISPATCH();
+
+#undef DISPATCH
+}
+
+#else
+
+int
+runThreaded(emulator *chip8, const int budget)
+{
+    int executed = 0;
+
+    syncCache(chip8);
+
+    /* no computed goto, so dispatch through the handler table */
+    while (executed < budget) {
+        if (chip8->pc >= AMOUNT_MEMORY_BYTES - 1) {
+            executeCachedInstruction(chip8);
+            executed++;
+            if (hostNeeded(chip8))
+                break;
+            continue;
+        }
+
+        instruction *ins = &chip8->cache[chip8->pc];
+        if (ins->fused == FUSED_UNKNOWN)
+            fuseInstruction(chip8, chip8->pc);
+
+        if (ins->fused == FUSED_IDLE) {
+            if (isIdle(chip8))
+                break;
+        } else if (ins->fused != FUSED_NONE && budget - executed >= FUSED_MAX_LENGTH) {
+            executed += fusedGroups[ins->fused].handler(chip8, ins);
+            continue;
+        }
+
+        chip8->pc += 2;
+        executed++;
+        handlers[ins->form](chip8, ins);
+
+        if (ins->form == FORM_FALLBACK && leaveEngine(chip8))
+            break;
+    }
+
+    return executed;
+}
+
+#endif
+
+int
+executeInstructions(emulator *chip8, const int budget)
+{
+    uint16_t    opcode;
+    int         executed = 0;
+
+    /* VIP timing charges every instruction its own cycles */
+    if (chip8->timers.model == TIMING_VIP)
+        return runVip(chip8, budget);
+
+    syncCache(chip8);
+
+    switch (chip8->dispatch) {
+        case DISPATCH_SWITCH:
+            while (executed < budget && !isIdle(chip8)) {
+                opcode = fetchOpcode(chip8);
+                chip8->pc += 2;
+                decodeAndExecuteOpcode(chip8, opcode);
+                executed++;
+                if (hostNeeded(chip8))
+                    break;
+            }
+            break;
+        case DISPATCH_CACHED:
+            while (executed < budget && !isIdle(chip8)) {
+                executeCachedInstruction(chip8);
+                executed++;
+                if (leaveEngine(chip8))
+                    break;
+            }
+            break;
+        case DISPATCH_JIT:
+            executed = runJit(chip8, budget);
+            break;
+        case DISPATCH_AOT:
+            executed = runAot(chip8, budget);
+            break;
+        default:
+            executed = runThreaded(chip8, budget);
+            break;
+    }
+
+    return executed;
+}
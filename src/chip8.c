@@ -2,19 +2,92 @@
 
 #include "../include/emulator.h"
 #include "../include/file.h"
+#include "../include/pacing.h"
+#include "../include/render.h"
+
+/* what the emulation thread shares with the main thread */
+typedef struct {
+    emulator        *chip8;                 // run by the emulation thread
+    presenter       *presenter;             // frames are published to
+    const char      *inputFile;             // ROM loaded again on reset
+    SDL_mutex       *lock;                  // guards events
+    input           events;                 // input gathered by the main thread
+    SDL_atomic_t    running;                // cleared by either thread to stop both
+} session;
+
+/*
+ * Run the emulator one 60Hz frame at a time,
+ * taking the input the main thread gathered and publishing every frame.
+ * Frames run on the emulated clock, the pacer only keeps them in step with real time.
+ */
+static int
+emulationThread(void *data)
+{
+    session     *session    = data;
+    emulator    *chip8      = session->chip8;
+
+    pacer framePacer;
+    startPacer(&framePacer, FRAMES_PER_SECOND);
+
+    while (SDL_AtomicGet(&session->running) && chip8->display.poweredOn) {
+
+        /* sleep until the start of the frame */
+        waitForFrame(&framePacer);
+
+        SDL_LockMutex(session->lock);
+        takeInput(&chip8->display, &session->events);
+        SDL_UnlockMutex(session->lock);
+
+        if (chip8->display.reset) {
+            FILE *resetRom = getRom(session->inputFile);
+            if (resetRom != NULL) {
+                initializeEmulator(chip8, resetRom);
+                fclose(resetRom);
+                if (chip8->jit != NULL)
+                    flushJit(chip8->jit);
+                if (chip8->aot != NULL)
+                    resetAot(chip8->aot);
+            }
+            resetDisplay(&chip8->display);
+            chip8->display.reset = SDL_FALSE;
+            startPacer(&framePacer, FRAMES_PER_SECOND);
+            continue;
+        }
 
-#define TIMER_DECREMENT_INTERVAL_MS (1000 / 60)
+        runFrame(chip8);
+
+        /* hand the frame to the main thread, which presents it per the policy */
+        publishFrame(session->presenter, &chip8->display);
+
+    }
+
+    /* the machine may have powered itself off, so let the main thread know */
+    SDL_AtomicSet(&session->running, 0);
+
+    SDL_Event wake = {0};
+    wake.type = session->presenter->wakeEvent;
+    SDL_PushEvent(&wake);
+
+    return 0;
+}
 
 int
 main(int argc, char **argv)
 {
 
-    srand(time(NULL));
-
     //SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_DEBUG);
 
     /* data that may be configured by args */
-    uint16_t    rate;
+    uint32_t    rate;
+    uint32_t    cycles;
+    uint8_t     dispatch;
+    int         present;
+    SDL_bool    compile;
+    const char  *output;
+    const char  *wav;
+    int         vblank;
+    int         timing;
+    uint32_t    headless;
     int         *opt        = malloc(sizeof(int));
     int         *longIndex  = malloc(sizeof(int));
     SDL_bool    *mute       = malloc(sizeof(SDL_bool));
@@ -22,6 +95,15 @@ main(int argc, char **argv)
 
     /* defaults */
     rate        = DEFAULT_IPS;          // 1000 instructions per second
+    cycles      = 0;                    // instructions per frame, 0 to derive from rate
+    dispatch    = DISPATCH_THREADED;    // dispatch engine (-d or --dispatch)
+    present     = PRESENT_VSYNC;        // presentation policy (-p or --present)
+    compile     = SDL_FALSE;            // compile rom ahead of time (-a or --aot)
+    output      = NULL;                 // compiled rom path (-o or --output)
+    wav         = NULL;                 // audio recording path (-w or --wav)
+    vblank      = VBLANK_AUTO;          // display wait quirk (-b or --vblank)
+    timing      = TIMING_IPS;           // timing model (-t or --timing)
+    headless    = 0;                    // frames to run without a window (-H or --headless)
     *longIndex  = 0;                    // index for longOptions
     *mute       = SDL_FALSE;            // mute audio (-m or --mute)
     *force      = SDL_FALSE;            // force load rom (-f or --force)
@@ -30,7 +112,7 @@ main(int argc, char **argv)
     while (
         argc > 1
         &&
-        (*opt = getopt_long(argc, argv,  "fmi:hv", longOptions, longIndex)) != -1
+        (*opt = getopt_long(argc, argv,  "fmi:c:d:p:ao:w:b:t:H:hv", longOptions, longIndex)) != -1
     ) {
         switch (*opt) {
             case 'f':   // force
@@ -40,8 +122,8 @@ main(int argc, char **argv)
                 *mute = SDL_TRUE;
                 break;
             case 'i':   // ips
-                if (isNumber(optarg)) {
-                    rate = atoi(optarg);
+                if (isNumber(optarg) && strtoull(optarg, NULL, 10) <= MAX_IPS) {
+                    rate = strtoull(optarg, NULL, 10);
                 } else {
                     SDL_LogError(
                         SDL_LOG_CATEGORY_APPLICATION,
@@ -55,10 +137,115 @@ main(int argc, char **argv)
                 }
 
                 /* validate the input before we start using it */
-                if (rate <= 0) {
+                if (rate == 0) {
                     rate = DEFAULT_IPS;
                 }
                 break;
+            case 'c':   // cycles
+                if (isNumber(optarg) && strtoull(optarg, NULL, 10) <= MAX_IPS / FRAMES_PER_SECOND) {
+                    cycles = strtoull(optarg, NULL, 10);
+                } else {
+                    SDL_LogError(
+                        SDL_LOG_CATEGORY_APPLICATION,
+                        "invalid cycles per frame input\n"
+                    );
+                    free(opt);
+                    free(longIndex);
+                    free(mute);
+                    free(force);
+                    return -1;
+                }
+                break;
+            case 'd':   // dispatch
+                dispatch = getDispatchEngine(optarg);
+                if (dispatch == 0) {
+                    SDL_LogError(
+                        SDL_LOG_CATEGORY_APPLICATION,
+                        "invalid dispatch engine: %s\n",
+                        optarg
+                    );
+                    free(opt);
+                    free(longIndex);
+                    free(mute);
+                    free(force);
+                    return -1;
+                }
+                break;
+            case 'p':   // present
+                present = getPresentPolicy(optarg);
+                if (present == 0) {
+                    SDL_LogError(
+                        SDL_LOG_CATEGORY_APPLICATION,
+                        "invalid presentation policy: %s\n",
+                        optarg
+                    );
+                    free(opt);
+                    free(longIndex);
+                    free(mute);
+                    free(force);
+                    return -1;
+                }
+                break;
+            case 'a':   // aot
+                compile = SDL_TRUE;
+                break;
+            case 'o':   // output
+                output = optarg;
+                break;
+            case 'w':   // wav
+                wav = optarg;
+                break;
+            case 'b':   // vblank
+                vblank = getVblankQuirk(optarg);
+                if (vblank == 0) {
+                    SDL_LogError(
+                        SDL_LOG_CATEGORY_APPLICATION,
+                        "invalid vblank quirk setting: %s\n",
+                        optarg
+                    );
+                    free(opt);
+                    free(longIndex);
+                    free(mute);
+                    free(force);
+                    return -1;
+                }
+                break;
+            case 't':   // timing
+                timing = getTimingModel(optarg);
+                if (timing == 0) {
+                    SDL_LogError(
+                        SDL_LOG_CATEGORY_APPLICATION,
+                        "invalid timing model: %s\n",
+                        optarg
+                    );
+                    free(opt);
+                    free(longIndex);
+                    free(mute);
+                    free(force);
+                    return -1;
+                }
+                break;
+            case 'H':   // headless
+                if (
+                    isNumber(optarg)
+                    &&
+                    strtoull(optarg, NULL, 10) > 0
+                    &&
+                    strtoull(optarg, NULL, 10) <= UINT32_MAX
+                ) {
+                    headless = strtoull(optarg, NULL, 10);
+                } else {
+                    SDL_LogError(
+                        SDL_LOG_CATEGORY_APPLICATION,
+                        "invalid headless frame count\n"
+                    );
+                    free(opt);
+                    free(longIndex);
+                    free(mute);
+                    free(force);
+                    return -1;
+                }
+                break;
             case 'h':   // help
                 printUsage(argv[0], SDL_LOG_PRIORITY_INFO);
                 return 0;
@@ -80,6 +267,9 @@ main(int argc, char **argv)
     free(opt);
     free(longIndex);
 
+    /* headless runs are reproducible, random numbers included */
+    srand(headless > 0 ? 0 : time(NULL));
+
     /* ensure that a ROM argument was given */
     if (optind >= argc) {
         SDL_LogError(
@@ -94,13 +284,14 @@ main(int argc, char **argv)
     const char  *inputFile  = argv[optind];
     FILE        *rom        = getRom(inputFile);
     struct stat st;
+    int         romVblank   = VBLANK_AUTO;
 
-    if (!force && !isRomValid(inputFile, rom, &st)) {
+    if (!*force && !isRomValid(inputFile, rom, &st, &romVblank)) {
         if (rom != NULL) fclose(rom);
         free(mute);
         free(force);
         return -1;      // error has already been logged
-    } else if (force) {
+    } else if (*force) {
         if (rom == NULL) {
             SDL_LogError(
                 SDL_LOG_CATEGORY_APPLICATION,
@@ -125,9 +316,66 @@ main(int argc, char **argv)
     }
     free(force);
 
-    emulator chip8;
+    /* 64KB of memory and its instruction cache are too large for the stack */
+    static emulator chip8;
     initializeEmulator(&chip8, rom);
     chip8.muted = *mute;
+    chip8.dispatch = dispatch;
+    chip8.vblankQuirk = vblank != VBLANK_AUTO ? vblank : romVblank;
+    chip8.jit = NULL;
+    chip8.aot = NULL;
+    chip8.timers.rate = rate;
+    chip8.timers.cyclesPerFrame = cycles;
+    chip8.timers.model = timing;
+
+    if (compile) {
+        rewind(rom);
+        char *hash = getHash(rom);
+        char *path = output != NULL ? strdup(output) : hash != NULL ? getAotCachePath(hash) : NULL;
+        const int result = path != NULL ? compileAot(&chip8, path) : -1;
+
+        if (result == 0) {
+            SDL_LogInfo(
+                SDL_LOG_CATEGORY_APPLICATION,
+                "compiled %s to %s\n",
+                inputFile,
+                path
+            );
+        }
+
+        free(hash);
+        free(path);
+        free(mute);
+        fclose(rom);
+        return result;
+    }
+
+    if (chip8.dispatch == DISPATCH_AOT) {
+        rewind(rom);
+        char *hash = getHash(rom);
+        if (hash != NULL)
+            chip8.aot = openAot(&chip8, hash);
+        free(hash);
+
+        if (chip8.aot == NULL) {
+            SDL_LogWarn(
+                SDL_LOG_CATEGORY_APPLICATION,
+                "compiled ROM unavailable, using threaded dispatch\n"
+            );
+            chip8.dispatch = DISPATCH_THREADED;
+        }
+    }
+
+    if (chip8.dispatch == DISPATCH_JIT) {
+        chip8.jit = createJit();
+        if (chip8.jit == NULL) {
+            SDL_LogWarn(
+                SDL_LOG_CATEGORY_APPLICATION,
+                "recompiler unavailable, using threaded dispatch\n"
+            );
+            chip8.dispatch = DISPATCH_THREADED;
+        }
+    }
     free(mute);
 
     if (chip8.muted) {
@@ -138,6 +386,44 @@ main(int argc, char **argv)
         );
     }
 
+    if (headless > 0) {
+        /* no window, audio device or pacing, the frames run as fast as they go */
+        setResolution(&chip8.display, CHIP8_WIDTH, CHIP8_HEIGHT);
+        resetDisplay(&chip8.display);
+        chip8.display.poweredOn = SDL_TRUE;
+        fclose(rom);
+
+        int status = 0;
+
+        if (wav != NULL && startRecording(&chip8.sound, wav) != 0) {
+            SDL_LogError(
+                SDL_LOG_CATEGORY_APPLICATION,
+                "failed to open %s for recording\n",
+                wav
+            );
+            status = -1;
+        } else {
+            uint32_t frame;
+            for (frame = 0; frame < headless && chip8.display.poweredOn; frame++)
+                runFrame(&chip8);
+
+            SDL_LogInfo(
+                SDL_LOG_CATEGORY_APPLICATION,
+                "ran %u frames, %llu %s of emulated time\n",
+                frame,
+                (unsigned long long)chip8.timers.cycle,
+                timing == TIMING_VIP ? "machine cycles" : "instructions"
+            );
+
+            stopRecording(&chip8.sound);
+        }
+
+        destroyJit(chip8.jit);
+        unloadAot(chip8.aot);
+        SDL_Quit();
+        return status;
+    }
+
 #if defined(__APPLE__)
 
     char *bin = getExecutablePathMACOS();
@@ -159,6 +445,15 @@ main(int argc, char **argv)
         free((void *)iconPath);
     }
 
+    chip8.display.keepDrawn = present == PRESENT_LAST_DRAW;
+
+    /* the window and the renderer stay on the main thread */
+    presenter framePresenter;
+    if (startPresenter(&framePresenter, chip8.display.window, present) != 0) {
+        SDL_DestroyWindow(chip8.display.window);
+        return -1;      // error has already been logged
+    }
+
     if (!chip8.muted && initAudio(&chip8.sound) != 0) {
         SDL_LogError(
             SDL_LOG_CATEGORY_APPLICATION,
@@ -168,134 +463,102 @@ main(int argc, char **argv)
         return -1;
     }
 
-    SDL_LogDebug(
-        SDL_LOG_CATEGORY_APPLICATION,
-        "running %s at %d IPS\n",
-        inputFile,
-        rate
-    );
-
-    fclose(rom);        // the rom is already written to memory
-
-    uint32_t ticks;
-    uint16_t opcode;
-    const double msPerInstruction   = 1000.0 / rate;
-    double nextInstructionTime      = SDL_GetTicks();
-
-    /* main loop */
-    while (chip8.display.poweredOn) {
-
-        /* update timers */
-        ticks = SDL_GetTicks();
-
-        /* check if it is time to execute the next instruction */
-        if ((double)ticks < nextInstructionTime)
-            continue;
-
-        /* schedule next instruction */
-        nextInstructionTime += msPerInstruction;
-
-        /*
-         * handle timer updates at 60Hz
-         * timers are decremented if they are greater than zero
-         */
-        if (ticks - chip8.timers.lastUpdate >= TIMER_DECREMENT_INTERVAL_MS) {
-            if (chip8.timers.delay > 0) {
-                chip8.timers.delay--;
-            }
-            if (chip8.timers.sound > 0) {
-                SDL_LogDebug(
-                    SDL_LOG_CATEGORY_APPLICATION,
-                    "beep\n"
-                );
-                if (!chip8.muted) {
-                    /* start audio playback */
-                    chip8.sound.playing = SDL_TRUE;
-                    SDL_PauseAudioDevice(chip8.sound.deviceId, 0);
-                }
-                chip8.timers.sound--;
-            } else if (chip8.sound.playing && !chip8.muted) {
-                /* stop audio playback and reset phase */
-                chip8.sound.playing = SDL_FALSE;
-                chip8.sound.phase   = 0.0;
-                SDL_PauseAudioDevice(chip8.sound.deviceId, 1);
-            }
-            chip8.timers.lastUpdate = ticks;
-        } else if (ticks < chip8.timers.lastUpdate) {
-            chip8.timers.lastUpdate = ticks;
-        }
+    if (wav != NULL && startRecording(&chip8.sound, wav) != 0) {
+        SDL_LogError(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "failed to open %s for recording\n",
+            wav
+        );
+        return -1;
+    }
 
+    if (timing == TIMING_VIP) {
         SDL_LogDebug(
             SDL_LOG_CATEGORY_APPLICATION,
-            "timers updated\n"
+            "running %s at COSMAC VIP speed\n",
+            inputFile
         );
-
-        /* handle events */
-        clearKeys(chip8.display.keyUp);
-
-        SDL_Event event;
-        while (SDL_PollEvent(&event))
-            handleEvent(&chip8.display, &event);
-
+    } else if (cycles > 0) {
         SDL_LogDebug(
             SDL_LOG_CATEGORY_APPLICATION,
-            "events handled\n"
+            "running %s at %u instructions per frame\n",
+            inputFile,
+            cycles
         );
-
-        if (chip8.display.reset) {
-            FILE *resetRom = getRom(inputFile);
-            if (resetRom != NULL) {
-                initializeEmulator(&chip8, resetRom);
-                fclose(resetRom);
-            }
-            resetDisplay(&chip8.display);
-            chip8.display.reset = SDL_FALSE;
-            nextInstructionTime = SDL_GetTicks();
-            continue;
-        }
-
-        /* fetch, decode, and execute opcode */
-        opcode = fetchOpcode(&chip8);
+    } else {
         SDL_LogDebug(
             SDL_LOG_CATEGORY_APPLICATION,
-            "handling opcode %x\n",
-            opcode
+            "running %s at %u IPS\n",
+            inputFile,
+            rate
         );
+    }
 
-        chip8.pc += 2; // increment program counter
+    fclose(rom);        // the rom is already written to memory
 
-        decodeAndExecuteOpcode(&chip8, opcode);
-        SDL_LogDebug(
+    /* the emulator runs on a thread of its own, feeding the presenter */
+    session emulation = {
+        .chip8      = &chip8,
+        .presenter  = &framePresenter,
+        .inputFile  = inputFile,
+        .lock       = SDL_CreateMutex()
+    };
+    SDL_AtomicSet(&emulation.running, 1);
+
+    SDL_Thread *thread = NULL;
+    if (emulation.lock != NULL)
+        thread = SDL_CreateThread(emulationThread, "teal8 emulation", &emulation);
+    if (thread == NULL) {
+        SDL_LogError(
             SDL_LOG_CATEGORY_APPLICATION,
-            "opcode successfully fetched, decoded, and executed\n"
+            "failed to start emulation thread: %s\n",
+            SDL_GetError()
         );
+        if (emulation.lock != NULL)
+            SDL_DestroyMutex(emulation.lock);
+        stopPresenter(&framePresenter);
+        SDL_DestroyWindow(chip8.display.window);
+        return -1;
+    }
 
-        /* draw the frame only if display has changed */
-        if (chip8.display.dirty) {
-            if (drawBackground(&chip8.display) != 0) {
-                SDL_LogError(
-                    SDL_LOG_CATEGORY_APPLICATION,
-                    "error drawing background: %s\n",
-                    SDL_GetError()
-                );
-                return -1;
-            }
+    pacer refreshPacer;
+    startPacer(&refreshPacer, RENDER_FIXED_RATE);
 
-            if (drawPixels(&chip8.display) != 0) {
-                SDL_LogError(
-                    SDL_LOG_CATEGORY_APPLICATION,
-                    "error drawing pixels: %s\n",
-                    SDL_GetError()
-                );
-                return -1;
-            }
+    /*
+     * main loop, the main thread owns the window:
+     * it sleeps until an event comes, a frame is published or a fixed present is due
+     */
+    while (SDL_AtomicGet(&emulation.running)) {
+
+        SDL_Event       event;
+        const uint64_t  timeout = present == PRESENT_FIXED
+            ? getTimeToFrame(&refreshPacer) / NS_PER_MS
+            : RENDER_WAKE_TIMEOUT_MS;
+
+        /* handle events */
+        if (SDL_WaitEventTimeout(&event, timeout)) {
+            SDL_LockMutex(emulation.lock);
+            do
+                handleEvent(&emulation.events, &event);
+            while (SDL_PollEvent(&event));
+            if (emulation.events.quit)
+                SDL_AtomicSet(&emulation.running, 0);
+            SDL_UnlockMutex(emulation.lock);
+        }
 
-            SDL_RenderPresent(chip8.display.renderer);
-            chip8.display.dirty = SDL_FALSE;
+        /* the fixed policy presents at its own pace, the others as frames are published */
+        if (present == PRESENT_FIXED) {
+            if (getTimeToFrame(&refreshPacer) >= NS_PER_MS)
+                continue;
+            waitForFrame(&refreshPacer);
         }
+        presentFrame(&framePresenter);
 
     }
 
+    SDL_WaitThread(thread, NULL);
+    SDL_DestroyMutex(emulation.lock);
+
     /* cleanup */
     SDL_LogDebug(
         SDL_LOG_CATEGORY_APPLICATION,
@@ -307,20 +570,18 @@ main(int argc, char **argv)
             SDL_LOG_CATEGORY_APPLICATION,
             "shutting down audio\n"
         );
-        if (chip8.sound.playing) {
-            /* stop audio playback */
-            SDL_PauseAudioDevice(chip8.sound.deviceId, 1);
-        }
         SDL_CloseAudioDevice(chip8.sound.deviceId);
     }
+    stopRecording(&chip8.sound);
+
+    destroyJit(chip8.jit);
+    unloadAot(chip8.aot);
 
     SDL_LogDebug(
         SDL_LOG_CATEGORY_APPLICATION,
         "shutting down display\n"
     );
-    free(chip8.display.pixels);
-    free(chip8.display.pixelDrawn);
-    SDL_DestroyRenderer(chip8.display.renderer);
+    stopPresenter(&framePresenter);
     SDL_DestroyWindow(chip8.display.window);
 
     SDL_LogDebug(
@@ -1,76 +1,267 @@
 #include <SDL.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "../include/display.h"
 
-#define BLACK_PIXEL_COLOR 0, 0, 0, 255
-#define WHITE_PIXEL_COLOR 255, 255, 255, 255
+/* is a plane selected for drawing? */
+#define PLANE_SELECTED(display, plane)  (((display)->planes >> (plane)) & 1)
 
 void
 resetDisplay(display *display)
 {
-    if (display->pixelDrawn == NULL)
-        return;
+    memset(display->framebuffer, 0, sizeof display->framebuffer);
 
-    memset(
-        display->pixelDrawn,
-        SDL_FALSE,
-        display->pixelHeight
-        *
-        display->pixelWidth
-        *
-        sizeof *display->pixelDrawn
-    );
+    display->planes     = 0x1;
+    display->dirty      = SDL_TRUE;
+    display->dirtyRows  = ALL_ROWS;
+}
+
+void
+clearDisplay(display *display)
+{
+    for (int plane = 0; plane < DISPLAY_PLANES; plane++) {
+        if (!PLANE_SELECTED(display, plane))
+            continue;
+        for (int row = 0; row < SCHIP_HEIGHT; row++)
+            memset(display->framebuffer[row][plane], 0, sizeof display->framebuffer[row][plane]);
+    }
 
-    display->dirty = SDL_TRUE;
+    display->dirty      = SDL_TRUE;
+    display->dirtyRows  = ALL_ROWS;
 }
 
 void
-createPixels(display *display)
+setResolution(display *display, const int width, const int height)
 {
-    if (display->pixels != NULL)
-        free(display->pixels);
+    display->pixelWidth     = width;
+    display->pixelHeight    = height;
 
-    if (display->pixelDrawn != NULL)
-        free(display->pixelDrawn);
+    memset(display->framebuffer, 0, sizeof display->framebuffer);
+    memset(display->drawnFramebuffer, 0, sizeof display->drawnFramebuffer);
+    display->dirty      = SDL_TRUE;
+    display->drawn      = SDL_TRUE;
+    display->dirtyRows  = ALL_ROWS;
+    display->drawnRows  = ALL_ROWS;
+}
 
-    display->pixelWidth     = display->width / SCALE;
-    display->pixelHeight    = display->height / SCALE;
+/*
+ * XOR placed sprite rows into consecutive framebuffer rows, every plane at once.
+ * Returns the number of rows in which a set pixel was cleared.
+ */
+static int
+xorRows(framebufferRow *target, const framebufferRow *rows, const int count)
+{
+    int collided    = 0;
+    int row         = 0;
 
-    display->pixels = calloc(
-        display->pixelHeight * display->pixelWidth,
-        sizeof(SDL_Rect));
+#if defined(__AVX2__)
 
-    if (display->pixels == NULL) {
-        SDL_LogError(
-            SDL_LOG_CATEGORY_APPLICATION,
-            "failed to allocate memory for pixels\n"
+    /* a row of both planes fills a 256-bit vector */
+    for (; row < count; row++) {
+        const __m256i   screen  = _mm256_loadu_si256((const __m256i *)target[row]);
+        const __m256i   sprite  = _mm256_loadu_si256((const __m256i *)rows[row]);
+
+        collided += !_mm256_testz_si256(screen, sprite);
+        _mm256_storeu_si256((__m256i *)target[row], _mm256_xor_si256(screen, sprite));
+    }
+
+#elif defined(__SSE2__)
+
+    /* one plane of a row per 128-bit vector */
+    for (; row < count; row++) {
+        const __m128i   screen0 = _mm_loadu_si128((const __m128i *)target[row][0]);
+        const __m128i   screen1 = _mm_loadu_si128((const __m128i *)target[row][1]);
+        const __m128i   sprite0 = _mm_loadu_si128((const __m128i *)rows[row][0]);
+        const __m128i   sprite1 = _mm_loadu_si128((const __m128i *)rows[row][1]);
+        const __m128i   clear   = _mm_cmpeq_epi8(
+            _mm_or_si128(_mm_and_si128(screen0, sprite0), _mm_and_si128(screen1, sprite1)),
+            _mm_setzero_si128()
         );
+
+        collided += _mm_movemask_epi8(clear) != 0xFFFF;
+        _mm_storeu_si128((__m128i *)target[row][0], _mm_xor_si128(screen0, sprite0));
+        _mm_storeu_si128((__m128i *)target[row][1], _mm_xor_si128(screen1, sprite1));
+    }
+
+#endif
+
+    for (; row < count; row++) {
+        uint64_t overlap = 0;
+
+        for (int plane = 0; plane < DISPLAY_PLANES; plane++) {
+            for (int word = 0; word < FRAMEBUFFER_WORDS; word++) {
+                overlap |= target[row][plane][word] & rows[row][plane][word];
+                target[row][plane][word] ^= rows[row][plane][word];
+            }
+        }
+        collided += overlap != 0;
+    }
+
+    return collided;
+}
+
+/*
+ * Place a left-aligned sprite row at a column of a packed plane row.
+ */
+static inline void
+placeRow(uint64_t *placed, const uint64_t bits, const int sX, const uint64_t rightMask)
+{
+    if (sX < 64) {
+        placed[0] = bits >> sX;
+        placed[1] = sX > 0 ? bits << (64 - sX) : 0;
+    } else {
+        placed[0] = 0;
+        placed[1] = bits >> (sX - 64);
+    }
+    placed[1] &= rightMask;
+}
+
+int
+drawSprite(
+    display *display,
+    const uint8_t *sprite,
+    const int rows,
+    const int bytesPerRow,
+    const int x,
+    const int y
+)
+{
+    framebufferRow  placed[SCHIP_HEIGHT];
+    uint64_t        changed     = 0;    // mask of the rows the sprite changes
+    const uint8_t   *data       = sprite;
+    const int       sX          = x % display->pixelWidth;
+    const int       sY          = y % display->pixelHeight;
+    const int       visible     = rows < display->pixelHeight - sY ? rows : display->pixelHeight - sY;
+
+    /* in lo-res the second word of a row is off screen */
+    const uint64_t rightMask = display->pixelWidth > 64 ? ~0ULL : 0;
+
+    /* left-align each sprite row in a word and place it in its plane */
+    for (int plane = 0; plane < DISPLAY_PLANES; plane++) {
+        if (!PLANE_SELECTED(display, plane)) {
+            for (int row = 0; row < visible; row++)
+                memset(placed[row][plane], 0, sizeof placed[row][plane]);
+            continue;
+        }
+
+        if (bytesPerRow == 2) {
+            /* 16x16 sprites, one big-endian 16-bit row at a time */
+            for (int row = 0; row < visible; row++) {
+                const uint64_t bits = (uint64_t)(data[2 * row] << 8 | data[2 * row + 1]) << 48;
+                placeRow(placed[row][plane], bits, sX, rightMask);
+            }
+        } else {
+            for (int row = 0; row < visible; row++)
+                placeRow(placed[row][plane], (uint64_t)data[row] << 56, sX, rightMask);
+        }
+
+        /* the next selected plane has a sprite of its own */
+        data += rows * bytesPerRow;
+    }
+
+    for (int row = 0; row < visible; row++) {
+        const uint64_t bits = placed[row][0][0] | placed[row][0][1] | placed[row][1][0] | placed[row][1][1];
+        changed |= (uint64_t)(bits != 0) << (sY + row);
+    }
+
+    const int collided = xorRows(&display->framebuffer[sY], placed, visible);
+
+    if (changed != 0) {
+        display->dirty      = SDL_TRUE;
+        display->drawn      = SDL_TRUE;
+        display->drawnRows  |= display->dirtyRows | changed;
+        display->dirtyRows  = 0;
+
+        /* only presenting as of the last draw needs the copy */
+        if (display->keepDrawn)
+            memcpy(display->drawnFramebuffer, display->framebuffer, sizeof display->framebuffer);
+    }
+
+    return collided;
+}
+
+/*
+ * Mark the rows of the current resolution dirty after the display moved.
+ */
+static void
+markScrolled(display *display)
+{
+    display->dirty      = SDL_TRUE;
+    display->dirtyRows  |= display->pixelHeight < 64 ? (1ULL << display->pixelHeight) - 1 : ALL_ROWS;
+}
+
+void
+scrollDown(display *display, const int lines)
+{
+    if (lines <= 0)
         return;
+
+    for (int plane = 0; plane < DISPLAY_PLANES; plane++) {
+        if (!PLANE_SELECTED(display, plane))
+            continue;
+
+        /* move rows from the bottom up so no source row is overwritten first */
+        for (int row = display->pixelHeight - 1; row >= 0; row--) {
+            uint64_t *words = display->framebuffer[row][plane];
+
+            if (row >= lines)
+                memcpy(words, display->framebuffer[row - lines][plane], sizeof display->framebuffer[row][plane]);
+            else
+                memset(words, 0, sizeof display->framebuffer[row][plane]);
+        }
     }
 
-    for (int y = 0; y < display->pixelHeight; y++) {
-        for (int x = 0; x < display->pixelWidth; x++) {
-            display->pixels[y * display->pixelWidth + x].x = x * SCALE;
-            display->pixels[y * display->pixelWidth + x].y = y * SCALE;
-            display->pixels[y * display->pixelWidth + x].w = SCALE;
-            display->pixels[y * display->pixelWidth + x].h = SCALE;
+    markScrolled(display);
+}
+
+void
+scrollRight(display *display, const int pixels)
+{
+    /* in lo-res the second word of a row is off screen */
+    const uint64_t rightMask = display->pixelWidth > 64 ? ~0ULL : 0;
+
+    if (pixels <= 0)
+        return;
+
+    for (int plane = 0; plane < DISPLAY_PLANES; plane++) {
+        if (!PLANE_SELECTED(display, plane))
+            continue;
+
+        for (int row = 0; row < display->pixelHeight; row++) {
+            uint64_t *words = display->framebuffer[row][plane];
+
+            words[1] = ((words[1] >> pixels) | (words[0] << (64 - pixels))) & rightMask;
+            words[0] >>= pixels;
         }
     }
 
-    display->pixelDrawn = calloc(
-        display->pixelHeight * display->pixelWidth,
-        sizeof(SDL_bool)
-    );
+    markScrolled(display);
+}
 
-    if (display->pixelDrawn == NULL) {
-        SDL_LogError(
-            SDL_LOG_CATEGORY_APPLICATION,
-            "failed to allocate memory for pixelDrawn\n"
-        );
-        free(display->pixels);
-        display->pixels = NULL;
+void
+scrollLeft(display *display, const int pixels)
+{
+    if (pixels <= 0)
         return;
+
+    for (int plane = 0; plane < DISPLAY_PLANES; plane++) {
+        if (!PLANE_SELECTED(display, plane))
+            continue;
+
+        for (int row = 0; row < display->pixelHeight; row++) {
+            uint64_t *words = display->framebuffer[row][plane];
+
+            words[0] = (words[0] << pixels) | (words[1] >> (64 - pixels));
+            words[1] <<= pixels;
+        }
     }
+
+    markScrolled(display);
 }
 
 int
@@ -107,7 +298,7 @@ initDisplay(display *display, const char *iconPath)
         SDL_WINDOWPOS_CENTERED,
         CHIP8_WIDTH * SCALE,
         CHIP8_HEIGHT * SCALE,
-        0
+        SDL_WINDOW_RESIZABLE
     );
     if (display->window == NULL) {
         SDL_LogError(
@@ -118,27 +309,6 @@ initDisplay(display *display, const char *iconPath)
         return -1;
     }
 
-    SDL_GetWindowSize(
-        display->window,
-        &display->width,
-        &display->height
-    );
-
-    display->renderer = SDL_CreateRenderer(
-        display->window,
-        -1,
-        SDL_RENDERER_ACCELERATED
-    );
-    if (display->renderer == NULL) {
-        SDL_LogError(
-            SDL_LOG_CATEGORY_APPLICATION,
-            "failed to create renderer: %s\n",
-            SDL_GetError()
-        );
-        SDL_DestroyWindow(display->window);
-        return -1;
-    }
-
     if (iconPath != NULL) {
         SDL_Surface *iconSurface = IMG_Load(iconPath);
         if (iconSurface == NULL) {
@@ -147,7 +317,6 @@ initDisplay(display *display, const char *iconPath)
                 "failed to load icon: %s\n",
                 IMG_GetError()
             );
-            SDL_DestroyRenderer(display->renderer);
             SDL_DestroyWindow(display->window);
             return -1;
         }
@@ -155,10 +324,7 @@ initDisplay(display *display, const char *iconPath)
         SDL_FreeSurface(iconSurface);
     }
 
-    display->pixels     = NULL;
-    display->pixelDrawn = NULL;
-
-    createPixels(display);
+    setResolution(display, CHIP8_WIDTH, CHIP8_HEIGHT);
 
     resetDisplay(display);
 
@@ -166,87 +332,87 @@ initDisplay(display *display, const char *iconPath)
     display->reset      = SDL_FALSE;
     display->dirty      = SDL_TRUE;
 
-    display->lastUpdate = 0;
+    display->vblank     = 0;
 
     return 0;
 }
 
 void
-handleEvent(display *display, const SDL_Event *event)
+handleEvent(input *input, const SDL_Event *event)
 {
     switch (event->type) {
         /* handle key presses */
         case SDL_KEYUP:
             switch (event->key.keysym.scancode) {
                 case SDL_SCANCODE_ESCAPE:
-                    display->poweredOn      = SDL_FALSE;
+                    input->quit = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_SPACE: // restart the rom
-                    display->reset = SDL_TRUE;
+                    input->reset = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_1:
-                    display->keyDown[0x1]   = SDL_FALSE;
-                    display->keyUp[0x1]     = SDL_TRUE;
+                    input->keyDown[0x1]   = SDL_FALSE;
+                    input->keyUp[0x1]     = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_2:
-                    display->keyDown[0x2]   = SDL_FALSE;
-                    display->keyUp[0x2]     = SDL_TRUE;
+                    input->keyDown[0x2]   = SDL_FALSE;
+                    input->keyUp[0x2]     = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_3:
-                    display->keyDown[0x3]   = SDL_FALSE;
-                    display->keyUp[0x3]     = SDL_TRUE;
+                    input->keyDown[0x3]   = SDL_FALSE;
+                    input->keyUp[0x3]     = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_4:
-                    display->keyDown[0xC]   = SDL_FALSE;
-                    display->keyUp[0xC]     = SDL_TRUE;
+                    input->keyDown[0xC]   = SDL_FALSE;
+                    input->keyUp[0xC]     = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_Q:
-                    display->keyDown[0x4]   = SDL_FALSE;
-                    display->keyUp[0x4]     = SDL_TRUE;
+                    input->keyDown[0x4]   = SDL_FALSE;
+                    input->keyUp[0x4]     = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_W:
-                    display->keyDown[0x5]   = SDL_FALSE;
-                    display->keyUp[0x5]     = SDL_TRUE;
+                    input->keyDown[0x5]   = SDL_FALSE;
+                    input->keyUp[0x5]     = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_E:
-                    display->keyDown[0x6]   = SDL_FALSE;
-                    display->keyUp[0x6]     = SDL_TRUE;
+                    input->keyDown[0x6]   = SDL_FALSE;
+                    input->keyUp[0x6]     = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_R:
-                    display->keyDown[0xD]   = SDL_FALSE;
-                    display->keyUp[0xD]     = SDL_TRUE;
+                    input->keyDown[0xD]   = SDL_FALSE;
+                    input->keyUp[0xD]     = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_A:
-                    display->keyDown[0x7]   = SDL_FALSE;
-                    display->keyUp[0x7]     = SDL_TRUE;
+                    input->keyDown[0x7]   = SDL_FALSE;
+                    input->keyUp[0x7]     = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_S:
-                    display->keyDown[0x8]   = SDL_FALSE;
-                    display->keyUp[0x8]     = SDL_TRUE;
+                    input->keyDown[0x8]   = SDL_FALSE;
+                    input->keyUp[0x8]     = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_D:
-                    display->keyDown[0x9]   = SDL_FALSE;
-                    display->keyUp[0x9]     = SDL_TRUE;
+                    input->keyDown[0x9]   = SDL_FALSE;
+                    input->keyUp[0x9]     = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_F:
-                    display->keyDown[0xE]   = SDL_FALSE;
-                    display->keyUp[0xE]     = SDL_TRUE;
+                    input->keyDown[0xE]   = SDL_FALSE;
+                    input->keyUp[0xE]     = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_Z:
-                    display->keyDown[0xA]   = SDL_FALSE;
-                    display->keyUp[0xA]     = SDL_TRUE;
+                    input->keyDown[0xA]   = SDL_FALSE;
+                    input->keyUp[0xA]     = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_X:
-                    display->keyDown[0x0]   = SDL_FALSE;
-                    display->keyUp[0x0]     = SDL_TRUE;
+                    input->keyDown[0x0]   = SDL_FALSE;
+                    input->keyUp[0x0]     = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_C:
-                    display->keyDown[0xB]   = SDL_FALSE;
-                    display->keyUp[0xB]     = SDL_TRUE;
+                    input->keyDown[0xB]   = SDL_FALSE;
+                    input->keyUp[0xB]     = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_V:
-                    display->keyDown[0xF]   = SDL_FALSE;
-                    display->keyUp[0xF]     = SDL_TRUE;
+                    input->keyDown[0xF]   = SDL_FALSE;
+                    input->keyUp[0xF]     = SDL_TRUE;
                     break;
                 default:
                     break;
@@ -256,52 +422,52 @@ handleEvent(display *display, const SDL_Event *event)
         case SDL_KEYDOWN:
             switch (event->key.keysym.scancode) {
                 case SDL_SCANCODE_1:
-                    display->keyDown[0x1]   = SDL_TRUE;
+                    input->keyDown[0x1]   = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_2:
-                    display->keyDown[0x2]   = SDL_TRUE;
+                    input->keyDown[0x2]   = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_3:
-                    display->keyDown[0x3]   = SDL_TRUE;
+                    input->keyDown[0x3]   = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_4:
-                    display->keyDown[0xC]   = SDL_TRUE;
+                    input->keyDown[0xC]   = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_Q:
-                    display->keyDown[0x4]   = SDL_TRUE;
+                    input->keyDown[0x4]   = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_W:
-                    display->keyDown[0x5]   = SDL_TRUE;
+                    input->keyDown[0x5]   = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_E:
-                    display->keyDown[0x6]   = SDL_TRUE;
+                    input->keyDown[0x6]   = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_R:
-                    display->keyDown[0xD]   = SDL_TRUE;
+                    input->keyDown[0xD]   = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_A:
-                    display->keyDown[0x7]   = SDL_TRUE;
+                    input->keyDown[0x7]   = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_S:
-                    display->keyDown[0x8]   = SDL_TRUE;
+                    input->keyDown[0x8]   = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_D:
-                    display->keyDown[0x9]   = SDL_TRUE;
+                    input->keyDown[0x9]   = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_F:
-                    display->keyDown[0xE]   = SDL_TRUE;
+                    input->keyDown[0xE]   = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_Z:
-                    display->keyDown[0xA]   = SDL_TRUE;
+                    input->keyDown[0xA]   = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_X:
-                    display->keyDown[0x0]   = SDL_TRUE;
+                    input->keyDown[0x0]   = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_C:
-                    display->keyDown[0xB]   = SDL_TRUE;
+                    input->keyDown[0xB]   = SDL_TRUE;
                     break;
                 case SDL_SCANCODE_V:
-                    display->keyDown[0xF]   = SDL_TRUE;
+                    input->keyDown[0xF]   = SDL_TRUE;
                     break;
                 default:
                     break;
@@ -310,55 +476,23 @@ handleEvent(display *display, const SDL_Event *event)
 
         /* quit gracefully */
         case SDL_QUIT:
-            display->poweredOn = SDL_FALSE;
+            input->quit = SDL_TRUE;
     }
 }
 
-int
-drawBackground(display *display)
-{
-    if (
-        SDL_SetRenderDrawColor(display->renderer, BLACK_PIXEL_COLOR)
-        != 0
-        ||
-        SDL_RenderClear(display->renderer)
-        != 0
-    )
-        return -1;
-
-    if (SDL_RenderClear(display->renderer) != 0)
-        return -1;
-
-    return 0;
-}
-
-int
-drawPixels(display *display)
+void
+takeInput(display *display, input *input)
 {
-    if (
-        display->pixelDrawn == NULL
-        ||
-        display->pixels == NULL
-        ||
-        SDL_SetRenderDrawColor(display->renderer, WHITE_PIXEL_COLOR)
-        != 0
-    )
-        return -1;
-
-    for (int y = 0; y < display->pixelHeight; y++)
-        for (int x = 0; x < display->pixelWidth; x++)
-            if (
-                display->pixelDrawn[y * display->pixelWidth + x]
-                &&
-                SDL_RenderFillRect(
-                    display->renderer,
-                    &display->pixels[y * display->pixelWidth + x]
-                )
-                != 0
-            )
-                return -1;
-
-    return 0;
+    memcpy(display->keyDown, input->keyDown, sizeof display->keyDown);
+    memcpy(display->keyUp, input->keyUp, sizeof display->keyUp);
+    clearKeys(input->keyUp);
+
+    if (input->quit)
+        display->poweredOn = SDL_FALSE;
+    if (input->reset) {
+        display->reset  = SDL_TRUE;
+        input->reset    = SDL_FALSE;
+    }
 }
 
 void
@@ -7,14 +7,13 @@
 #include <sys/syslimits.h>
 
 #include <SDL_log.h>
-#include <SDL_timer.h>
 
 #include "../include/emulator.h"
 
 #define FONT_START_ADDRESS      0x00
 #define PROGRAM_START_ADDRESS   0x200
 
-#define VBLANK_INTERVAL_MS      (1000 / 60)
+#define SAMPLES_PER_FRAME       (AUDIO_SAMPLE_RATE / FRAMES_PER_SECOND)
 
 void
 printVersion(const char *programName)
@@ -34,10 +33,23 @@ printUsage(const char *programName, const SDL_LogPriority priority)
         SDL_LOG_CATEGORY_APPLICATION,
         priority,
         "%s version %s\n"
-        "usage:\t%s [-m|--mute] [-f|--force] [-i|--ips <number>] <rom>\n"
+        "usage:\t%s [-m|--mute] [-f|--force] [-i|--ips <number>] "
+        "[-c|--cycles <number>] [-d|--dispatch <engine>] "
+        "[-p|--present <policy>] [-w|--wav <file>] [-b|--vblank <quirk>] [-t|--timing <model>] "
+        "[-H|--headless <frames>] <rom>\n"
+        "\t%s --aot [-o|--output <file>] <rom>\n"
         "\t-m (--mute)\tmute audio\n"
         "\t-f (--force)\tforce load rom regardless of validity\n"
         "\t-i (--ips)\tinstructions per second (default: %d)\n"
+        "\t-c (--cycles)\tinstructions per frame, overrides --ips\n"
+        "\t-d (--dispatch)\tswitch, cached, threaded, jit or aot (default: threaded)\n"
+        "\t-p (--present)\tvsync, fixed or last (default: vsync)\n"
+        "\t-w (--wav)\trecord audio to a wav file\n"
+        "\t-b (--vblank)\tauto, on or off, sprites wait for vertical blank (default: auto)\n"
+        "\t-t (--timing)\tips or vip, vip runs at COSMAC VIP speed (default: ips)\n"
+        "\t-H (--headless)\trun this many frames without a window or pacing\n"
+        "\t-a (--aot)\tcompile rom to a shared object and exit\n"
+        "\t-o (--output)\tshared object path (default: cache)\n"
         "\t<rom>\t\tchip8 rom path\n"
         "controls:\n"
         "\t1 2 3 4\n"
@@ -47,6 +59,7 @@ printUsage(const char *programName, const SDL_LogPriority priority)
         programName,
         TEAL8VERSION,
         programName,
+        programName,
         DEFAULT_IPS
     );
 }
@@ -155,6 +168,47 @@ getWindowIconPath(char *binPath)
     return iconPath;
 }
 
+uint8_t
+getDispatchEngine(const char *name)
+{
+    if (strcmp(name, "switch") == 0)
+        return DISPATCH_SWITCH;
+    if (strcmp(name, "cached") == 0)
+        return DISPATCH_CACHED;
+    if (strcmp(name, "threaded") == 0)
+        return DISPATCH_THREADED;
+    if (strcmp(name, "jit") == 0)
+        return DISPATCH_JIT;
+    if (strcmp(name, "aot") == 0)
+        return DISPATCH_AOT;
+
+    return 0;
+}
+
+int
+getVblankQuirk(const char *name)
+{
+    if (strcmp(name, "auto") == 0)
+        return VBLANK_AUTO;
+    if (strcmp(name, "on") == 0)
+        return VBLANK_ON;
+    if (strcmp(name, "off") == 0)
+        return VBLANK_OFF;
+
+    return 0;
+}
+
+int
+getTimingModel(const char *name)
+{
+    if (strcmp(name, "ips") == 0)
+        return TIMING_IPS;
+    if (strcmp(name, "vip") == 0)
+        return TIMING_VIP;
+
+    return 0;
+}
+
 SDL_bool
 isNumber(const char num[])
 {
@@ -240,17 +294,14 @@ writeFontToMemory(uint8_t *memory)
 void
 writeRomToMemory(emulator *chip8, FILE *rom)
 {
-    chip8->pc = PROGRAM_START_ADDRESS;
-
-    while (
-        chip8->pc < AMOUNT_MEMORY_BYTES
-        &&
-        fread(&chip8->memory[chip8->pc], 1, 1, rom) == 1
-    ) {
-        chip8->pc++;
-    }
+    const size_t size = fread(
+        &chip8->memory[PROGRAM_START_ADDRESS],
+        1,
+        AMOUNT_MEMORY_BYTES - PROGRAM_START_ADDRESS,
+        rom
+    );
 
-    if (chip8->pc >= AMOUNT_MEMORY_BYTES) {
+    if (size == AMOUNT_MEMORY_BYTES - PROGRAM_START_ADDRESS && fgetc(rom) != EOF) {
         SDL_LogWarn(
             SDL_LOG_CATEGORY_APPLICATION,
             "ROM too large, truncated at %d bytes\n",
@@ -270,8 +321,14 @@ initializeEmulator(emulator *chip8, FILE *rom)
     clearKeys(chip8->display.keyDown);
     clearKeys(chip8->display.keyUp);
 
-    chip8->lastUpdate           = 0;
-    chip8->timers.lastUpdate    = 0;
+    chip8->state                = STATE_RUNNING;
+    chip8->display.vblank       = 0;
+
+    /* power-on restarts the emulated clock */
+    chip8->timers.delay = 0;
+    chip8->timers.sound = 0;
+    chip8->timers.cycle = 0;
+    chip8->timers.frame = 0;
 
     /* ensure registers and stack are cleared */
     memset(chip8->v, 0, sizeof chip8->v);
@@ -279,6 +336,10 @@ initializeEmulator(emulator *chip8, FILE *rom)
     chip8->stack.sp = 0;
 
     chip8->specType = CHIP8;
+
+    resetAudio(&chip8->sound);
+    clearCache(chip8->cache);
+    chip8->cacheSpecType = chip8->specType;
 }
 
 /*
@@ -322,6 +383,275 @@ randomNumber(int min, int max)
     return x % range + min;
 }
 
+void
+writeMemory(emulator *chip8, const uint32_t address, const uint8_t value)
+{
+    if (address >= AMOUNT_MEMORY_BYTES)
+        return;
+
+    chip8->memory[address] = value;
+    invalidateCache(chip8->cache, address);
+    if (chip8->jit != NULL)
+        invalidateJit(chip8->jit, address);
+    if (chip8->aot != NULL)
+        invalidateAot(chip8->aot, address);
+}
+
+SDL_bool
+isSkip(const uint16_t opcode)
+{
+    switch (opcode >> 12) {
+        case 0x3:
+        case 0x4:
+        case 0x9:
+            return SDL_TRUE;
+        case 0x5:
+            return (opcode & 0x000F) == 0x0;
+        case 0xE:
+            return (opcode & 0x00FF) == 0x9E || (opcode & 0x00FF) == 0xA1;
+    }
+
+    return SDL_FALSE;
+}
+
+int
+getSpritePlanes(const emulator *chip8)
+{
+    return (chip8->display.planes & 0x1) + (chip8->display.planes >> 1);
+}
+
+int
+getSpriteRows(const emulator *chip8, const uint8_t n)
+{
+    const int bytesPerRow   = n == 0 ? 2 : 1;
+    const int planes        = getSpritePlanes(chip8);
+
+    if (chip8->i >= AMOUNT_MEMORY_BYTES || planes == 0)
+        return 0;
+
+    /* rows past the end of memory are not drawn */
+    return SDL_min(n == 0 ? 16 : n, (AMOUNT_MEMORY_BYTES - chip8->i) / (bytesPerRow * planes));
+}
+
+uint16_t
+getSkipLength(const emulator *chip8, const uint16_t address)
+{
+    if (
+        address < AMOUNT_MEMORY_BYTES - 1
+        &&
+        chip8->memory[address] == 0xF0
+        &&
+        chip8->memory[address + 1] == 0x00
+    )
+        return 4;
+
+    return 2;
+}
+
+void
+skipInstruction(emulator *chip8)
+{
+    chip8->pc += getSkipLength(chip8, chip8->pc);
+}
+
+/*
+ * Switch a CHIP-8 program to SCHIP quirks on its first SCHIP opcode.
+ * XO-CHIP includes the SCHIP opcodes, so XO-CHIP programs stay XO-CHIP.
+ */
+static void
+detectSchip(emulator *chip8)
+{
+    if (chip8->specType == CHIP8)
+        chip8->specType = SCHIP;
+}
+
+/*
+ * Check whether sprites wait for the vertical blank interrupt, as on the COSMAC VIP.
+ * SCHIP and XO-CHIP draw at once unless the quirk is forced on.
+ */
+static SDL_bool
+waitsForVblank(const emulator *chip8)
+{
+    if (chip8->vblankQuirk == VBLANK_AUTO)
+        return chip8->specType == CHIP8;
+
+    return chip8->vblankQuirk == VBLANK_ON;
+}
+
+SDL_bool
+hostNeeded(const emulator *chip8)
+{
+    return !chip8->display.poweredOn
+        || chip8->display.dirty
+        || chip8->sound.pending
+        || chip8->state != STATE_RUNNING;
+}
+
+SDL_bool
+isIdleLoop(const emulator *chip8, const uint16_t address)
+{
+    if (address >= AMOUNT_MEMORY_BYTES - 1)
+        return SDL_FALSE;
+
+    const uint16_t opcode = (chip8->memory[address] << 8) | chip8->memory[address + 1];
+
+    /* jump to self, the program has halted */
+    if (opcode == (0x1000 | address))
+        return SDL_TRUE;
+
+    /* FX07 followed by a skip on Vx and a jump back to the FX07 */
+    if ((opcode & 0xF0FF) != 0xF007 || address + 5 >= AMOUNT_MEMORY_BYTES)
+        return SDL_FALSE;
+
+    const uint16_t  skip    = (chip8->memory[address + 2] << 8) | chip8->memory[address + 3];
+    const uint16_t  jump    = (chip8->memory[address + 4] << 8) | chip8->memory[address + 5];
+
+    return jump == (0x1000 | address)
+        && (skip & 0x0F00) == (opcode & 0x0F00)
+        && (skip >> 12 == 0x3 || skip >> 12 == 0x4);
+}
+
+SDL_bool
+isIdle(emulator *chip8)
+{
+    const uint16_t pc = chip8->pc;
+
+    if (!isIdleLoop(chip8, pc))
+        return SDL_FALSE;
+
+    const uint16_t opcode = (chip8->memory[pc] << 8) | chip8->memory[pc + 1];
+
+    /* jump to self, the program has halted */
+    if (opcode >> 12 == 0x1)
+        return SDL_TRUE;
+
+    const uint8_t   x       = (opcode & 0x0F00) >> 8;
+    const uint16_t  skip    = (chip8->memory[pc + 2] << 8) | chip8->memory[pc + 3];
+    const uint8_t   nn      = skip & 0x00FF;
+
+    switch (skip >> 12) {
+        case 0x3:
+            /* loops until the delay timer reaches NN */
+            if (chip8->timers.delay == nn)
+                return SDL_FALSE;
+            break;
+        case 0x4:
+            /* loops while the delay timer is NN */
+            if (chip8->timers.delay != nn)
+                return SDL_FALSE;
+            break;
+        default:
+            return SDL_FALSE;
+    }
+
+    chip8->v[x] = chip8->timers.delay;
+    return SDL_TRUE;
+}
+
+/*
+ * Get the instruction a frame starts at, rate * frame / 60 rounded down.
+ * Whole seconds are split off first so the product cannot overflow at high rates.
+ */
+static uint64_t
+getFrameStart(const uint64_t frame, const uint32_t rate)
+{
+    return frame / FRAMES_PER_SECOND * rate + frame % FRAMES_PER_SECOND * rate / FRAMES_PER_SECOND;
+}
+
+/*
+ * Get the number of instructions, or VIP machine cycles, left in the current frame.
+ * Derived from the start and end of the frame on the emulated clock,
+ * so rates that are not a multiple of 60 never drift
+ * and a VIP instruction overrunning a frame is paid for in the next.
+ *
+ * Parameters:
+ * the timers,
+ * the clock at which the program starts running in this frame
+ */
+static int
+getFrameBudget(const timers *timers, const uint64_t start)
+{
+    if (timers->model == TIMING_VIP)
+        return (int64_t)((timers->frame + 1) * VIP_FRAME_CYCLES) - (int64_t)start;
+
+    if (timers->cyclesPerFrame > 0)
+        return timers->cyclesPerFrame;
+
+    return getFrameStart(timers->frame + 1, timers->rate) - getFrameStart(timers->frame, timers->rate);
+}
+
+void
+runFrame(emulator *chip8)
+{
+    /*
+     * the 60Hz timer tick starts the frame
+     * timers are decremented if they are greater than zero
+     */
+    if (chip8->timers.delay > 0)
+        chip8->timers.delay--;
+    if (chip8->timers.sound > 0) {
+        SDL_LogDebug(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "beep\n"
+        );
+        chip8->timers.sound--;
+    }
+
+    /* the vertical blank a sprite waited for, or the keys of this frame for FX0A to look at */
+    chip8->state = STATE_RUNNING;
+
+    /* on the VIP the display interrupt runs first, the program gets the rest of the frame */
+    const uint64_t  start       = chip8->timers.cycle
+        + (chip8->timers.model == TIMING_VIP ? VIP_INTERRUPT_CYCLES : 0);
+    const int       budget      = getFrameBudget(&chip8->timers, start);
+    SDL_bool        beeping     = chip8->timers.sound > 0;  // since the last streamed sample
+    SDL_bool        redraw      = SDL_FALSE;
+    int             executed    = 0;
+    int             streamed    = 0;                        // samples of this frame already streamed
+
+    /*
+     * run the frame's instructions in batches;
+     * a batch ends early when the display or the sound changed,
+     * and the frame ends early once the program waits or idles until the next tick
+     */
+    while (
+        executed < budget
+        &&
+        chip8->display.poweredOn
+        &&
+        chip8->state == STATE_RUNNING
+        &&
+        !isIdle(chip8)
+    ) {
+        executed += executeInstructions(chip8, budget - executed);
+        if (chip8->display.dirty) {
+            redraw = SDL_TRUE;
+            chip8->display.dirty = SDL_FALSE;
+        }
+        if (chip8->sound.pending) {
+            /* the sound changed at this instruction, stream the frame up to it */
+            const int position = (int64_t)SDL_min(executed, budget) * SAMPLES_PER_FRAME / budget;
+            streamAudio(&chip8->sound, position - streamed, beeping);
+            streamed    = position;
+            beeping     = chip8->timers.sound > 0;
+        }
+    }
+
+    /* the rest of the frame sounds like its last instruction left it */
+    streamAudio(&chip8->sound, SAMPLES_PER_FRAME - streamed, beeping);
+
+    SDL_LogDebug(
+        SDL_LOG_CATEGORY_APPLICATION,
+        "%d instructions executed\n",
+        executed
+    );
+
+    /* idle instructions pass all the same, so the next frame starts on time */
+    chip8->timers.cycle = start + SDL_max(executed, budget);
+    chip8->timers.frame++;
+    chip8->display.dirty = redraw;
+}
+
 uint16_t
 fetchOpcode(emulator *chip8)
 {
@@ -352,13 +682,14 @@ decodeAndExecuteOpcode(emulator *chip8, uint16_t opcode)
             switch (y) {
                 case 0xC:
                     /* scroll the display N lines down */
-                    chip8->specType = SCHIP;
+                    scrollDown(&chip8->display, n);
+                    detectSchip(chip8);
                     break;
             }
             switch (opcode & 0x00FF) {
                 case 0xE0:
-                    /* clear the display */
-                    resetDisplay(&chip8->display);
+                    /* clear the selected planes of the display */
+                    clearDisplay(&chip8->display);
                     break;
                 case 0xEE:
                     /* return from subroutine */
@@ -366,11 +697,13 @@ decodeAndExecuteOpcode(emulator *chip8, uint16_t opcode)
                     break;
                 case 0xFB:
                     /* scroll the display 4 pixels to the right */
-                    chip8->specType = SCHIP;
+                    scrollRight(&chip8->display, 4);
+                    detectSchip(chip8);
                     break;
                 case 0xFC:
                     /* scroll the display 4 pixels to the left */
-                    chip8->specType = SCHIP;
+                    scrollLeft(&chip8->display, 4);
+                    detectSchip(chip8);
                     break;
                 case 0xFD:
                     /* exit the interpreter */
@@ -378,31 +711,25 @@ decodeAndExecuteOpcode(emulator *chip8, uint16_t opcode)
                     break;
                 case 0xFE:
                     /* set the CHIP-8 display mode to 64x32 */
-                    if (chip8->display.width == SCHIP_WIDTH * SCALE && chip8->display.height == SCHIP_HEIGHT * SCALE) {
-                        SDL_SetWindowSize(chip8->display.window, CHIP8_WIDTH * SCALE, CHIP8_HEIGHT * SCALE);
-                        SDL_GetWindowSize(chip8->display.window, &chip8->display.width, &chip8->display.height);
-                        SDL_SetWindowPosition(chip8->display.window, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED);
-                        createPixels(&chip8->display);
+                    if (chip8->display.pixelWidth == SCHIP_WIDTH) {
+                        setResolution(&chip8->display, CHIP8_WIDTH, CHIP8_HEIGHT);
                         SDL_LogInfo(
                             SDL_LOG_CATEGORY_APPLICATION,
                             "display mode switched to lo-res\n"
                         );
                     }
-                    chip8->specType = SCHIP;
+                    detectSchip(chip8);
                     break;
                 case 0xFF:
                     /* set the CHIP-8 display mode to 128x64 */
-                    if (chip8->display.width == CHIP8_WIDTH * SCALE && chip8->display.height == CHIP8_HEIGHT * SCALE) {
-                        SDL_SetWindowSize(chip8->display.window, SCHIP_WIDTH * SCALE, SCHIP_HEIGHT * SCALE);
-                        SDL_GetWindowSize(chip8->display.window, &chip8->display.width, &chip8->display.height);
-                        SDL_SetWindowPosition(chip8->display.window, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED);
-                        createPixels(&chip8->display);
+                    if (chip8->display.pixelWidth == CHIP8_WIDTH) {
+                        setResolution(&chip8->display, SCHIP_WIDTH, SCHIP_HEIGHT);
                         SDL_LogInfo(
                             SDL_LOG_CATEGORY_APPLICATION,
                             "display mode switched to hi-res\n"
                         );
                     }
-                    chip8->specType = SCHIP;
+                    detectSchip(chip8);
                     break;
                 default:
                     /* call RCA 1802 program at address NNN */
@@ -421,17 +748,35 @@ decodeAndExecuteOpcode(emulator *chip8, uint16_t opcode)
         case 0x3:
             /* skip next instruction if Vx == NN */
             if (chip8->v[x] == nn)
-                chip8->pc += 2;
+                skipInstruction(chip8);
             break;
         case 0x4:
             /* skip next instruction if Vx != NN */
             if (chip8->v[x] != nn)
-                chip8->pc += 2;
+                skipInstruction(chip8);
             break;
         case 0x5:
-            /* skip next instruction if Vx == Vy */
-            if (chip8->v[x] == chip8->v[y])
-                chip8->pc += 2;
+            switch (n) {
+                case 0x0:
+                    /* skip next instruction if Vx == Vy */
+                    if (chip8->v[x] == chip8->v[y])
+                        skipInstruction(chip8);
+                    break;
+                case 0x2:
+                    /* store Vx to Vy in memory starting at address I, in either order */
+                    for (int i = 0; i <= abs(x - y); i++)
+                        writeMemory(chip8, chip8->i + i, chip8->v[x < y ? x + i : x - i]);
+                    chip8->specType = XOCHIP;
+                    break;
+                case 0x3:
+                    /* fill Vx to Vy with values from memory starting at address I */
+                    for (int i = 0; i <= abs(x - y); i++) {
+                        if (chip8->i + i < AMOUNT_MEMORY_BYTES)
+                            chip8->v[x < y ? x + i : x - i] = chip8->memory[chip8->i + i];
+                    }
+                    chip8->specType = XOCHIP;
+                    break;
+            }
             break;
         case 0x6:
             /* set Vx to NN */
@@ -506,7 +851,7 @@ decodeAndExecuteOpcode(emulator *chip8, uint16_t opcode)
                      * set VF to the least significant bit of Vx before the shift
                      */
                     operand = chip8->v[x];
-                    if (chip8->specType == CHIP8)
+                    if (chip8->specType != SCHIP)
                         chip8->v[x] = chip8->v[y];
                     chip8->v[x] >>= 1;
                     chip8->v[0xF] = operand & 0x01;
@@ -530,7 +875,7 @@ decodeAndExecuteOpcode(emulator *chip8, uint16_t opcode)
                      * set VF to the least significant bit of Vx before the shift
                      */
                     operand = chip8->v[x];
-                    if (chip8->specType == CHIP8)
+                    if (chip8->specType != SCHIP)
                         chip8->v[x] = chip8->v[y];
                     chip8->v[x] <<= 1;
                     chip8->v[0xF] = operand >> 7;
@@ -540,7 +885,7 @@ decodeAndExecuteOpcode(emulator *chip8, uint16_t opcode)
         case 0x9:
             /* skip next instruction if Vx != Vy */
             if (chip8->v[x] != chip8->v[y])
-                chip8->pc += 2;
+                skipInstruction(chip8);
             break;
         case 0xA:
             /* set I to address NNN */
@@ -551,7 +896,7 @@ decodeAndExecuteOpcode(emulator *chip8, uint16_t opcode)
              * jump to address NNN + V0;
              * on SCHIP, jump to XNN + vX
              */
-            if (chip8->specType == CHIP8)
+            if (chip8->specType != SCHIP)
                 chip8->pc = nnn + chip8->v[0];
             else
                 chip8->pc = nnn + chip8->v[x];
@@ -563,60 +908,78 @@ decodeAndExecuteOpcode(emulator *chip8, uint16_t opcode)
         case 0xD: // DXYN
             /*
              * draw a sprite at position Vx, Vy;
-             * the sprite is 0xN pixels tall;
-             * on/off based on value in I;
-             * set VF to 1 if any set pixels are changed to unset, 0 otherwise
+             * the sprite is 0xN pixels tall, or 16x16 pixels (32 bytes) if N is 0;
+             * on/off based on value in I, one sprite per selected plane;
+             * set VF to 1 if any set pixels are changed to unset, 0 otherwise;
+             * in SCHIP hi-res set VF to the number of rows in which that happened
              */
-            while (1) { // wait for vertical blank interrupt
-                if (chip8->display.lastUpdate + VBLANK_INTERVAL_MS < SDL_GetTicks())
-                    break;
+            /* one sprite per frame, wait for the vertical blank interrupt and draw then */
+            if (waitsForVblank(chip8) && chip8->timers.frame < chip8->display.vblank) {
+                chip8->pc -= 2;
+                chip8->state = STATE_VBLANK;
+                break;
             }
 
-            const uint8_t sX    = chip8->v[x] % chip8->display.pixelWidth;
-            const uint8_t sY    = chip8->v[y] % chip8->display.pixelHeight;
-            const uint8_t sH    = n;
-
-            chip8->v[0xF]       = 0;
+            const int rows      = getSpriteRows(chip8, n);
+            const int collided  = drawSprite(
+                &chip8->display,
+                &chip8->memory[rows > 0 ? chip8->i : 0],
+                rows,
+                n == 0 ? 2 : 1,
+                chip8->v[x],
+                chip8->v[y]
+            );
+            chip8->v[0xF] = chip8->specType == SCHIP && chip8->display.pixelWidth == SCHIP_WIDTH
+                ? collided
+                : collided > 0;
+            if (n == 0)
+                detectSchip(chip8);
 
-            for (int yline = 0; yline < sH; yline++) {
-                if (sY + yline >= chip8->display.pixelHeight)
-                    continue; // clip vertically
-
-                if (chip8->i + yline >= AMOUNT_MEMORY_BYTES)
-                    break; // prevent buffer overflow
-
-                const uint8_t pixel = chip8->memory[chip8->i + yline];
-                for (int xline = 0; xline < 8; xline++) {
-                    if ((pixel & (0x80 >> xline)) != 0) {
-                        if (sX + xline >= chip8->display.pixelWidth)
-                            continue; // clip horizontally
-
-                        if (chip8->display.pixelDrawn[(sY + yline) * chip8->display.pixelWidth + (sX + xline)])
-                            chip8->v[0xF] = 1;
-
-                        chip8->display.pixelDrawn[(sY + yline) * chip8->display.pixelWidth + (sX + xline)] ^= SDL_TRUE;
-                        chip8->display.dirty = SDL_TRUE;
-                    }
-                }
-            }
-            chip8->display.lastUpdate = SDL_GetTicks();
+            chip8->display.vblank = chip8->timers.frame + 1;
             break;
         case 0xE:
             switch (opcode & 0x00FF) {
                 case 0x9E:
                     /* skip next instruction if key with the value of Vx is pressed */
                     if (chip8->display.keyDown[chip8->v[x]])
-                        chip8->pc += 2;
+                        skipInstruction(chip8);
                     break;
                 case 0xA1:
                     /* skip next instruction if key with the value of Vx is not pressed */
                     if (!chip8->display.keyDown[chip8->v[x]])
-                        chip8->pc += 2;
+                        skipInstruction(chip8);
                     break;
             }
             break;
         case 0xF:
             switch (opcode & 0x00FF) {
+                case 0x00:
+                    /* set I to the 16-bit address NNNN in the next two bytes */
+                    if (x == 0) {
+                        chip8->i = chip8->pc < AMOUNT_MEMORY_BYTES - 1
+                            ? (chip8->memory[chip8->pc] << 8) | chip8->memory[chip8->pc + 1]
+                            : 0;
+                        chip8->pc += 2;
+                        chip8->specType = XOCHIP;
+                    }
+                    break;
+                case 0x01:
+                    /* select the planes drawn to by bitmask N */
+                    chip8->display.planes = x & 0x3;
+                    chip8->specType = XOCHIP;
+                    break;
+                case 0x02:
+                    /* load the 16-byte audio pattern from memory starting at address I */
+                    if (x == 0) {
+                        uint8_t pattern[AUDIO_PATTERN_BYTES] = {0};
+                        for (int i = 0; i < AUDIO_PATTERN_BYTES; i++) {
+                            if (chip8->i + i < AMOUNT_MEMORY_BYTES)
+                                pattern[i] = chip8->memory[chip8->i + i];
+                        }
+                        setAudioPattern(&chip8->sound, pattern);
+                        chip8->specType = XOCHIP;
+                    }
+                    break;
                 case 0x07:
                     /* set Vx to the value of the delay timer */
                     chip8->v[x] = chip8->timers.delay;
@@ -624,13 +987,16 @@ decodeAndExecuteOpcode(emulator *chip8, uint16_t opcode)
                 case 0x0A:
                     /*
                      * wait for a key press
-                     * and store the value of the key in Vx
+                     * and store the value of the key in Vx;
+                     * without a released key the program halts until the next frame looks again
                      */
                     chip8->pc -= 2;
+                    chip8->state = STATE_KEY;
                     for (int i = 0x0; i <= 0xF; i++)
                         if (chip8->display.keyUp[i]) {
                             chip8->v[x] = i;
                             chip8->pc += 2;
+                            chip8->state = STATE_RUNNING;
                             break;
                         }
 
@@ -640,8 +1006,9 @@ decodeAndExecuteOpcode(emulator *chip8, uint16_t opcode)
                     chip8->timers.delay = chip8->v[x];
                     break;
                 case 0x18:
-                    /* set the sound timer to Vx */
+                    /* set the sound timer to Vx, the sound changes at this instruction */
                     chip8->timers.sound = chip8->v[x];
+                    chip8->sound.pending = SDL_TRUE;
                     break;
                 case 0x1E:
                     /* add Vx to I */
@@ -656,20 +1023,20 @@ decodeAndExecuteOpcode(emulator *chip8, uint16_t opcode)
                      * store the binary-coded base-10 representation of Vx
                      * in memory locations I, I+1, and I+2
                      */
-                    if (chip8->i < AMOUNT_MEMORY_BYTES)
-                        chip8->memory[chip8->i] = chip8->v[x] / 100;
-                    if (chip8->i + 1 < AMOUNT_MEMORY_BYTES)
-                        chip8->memory[chip8->i + 1] = (chip8->v[x] / 10) % 10;
-                    if (chip8->i + 2 < AMOUNT_MEMORY_BYTES)
-                        chip8->memory[chip8->i + 2] = chip8->v[x] % 10;
+                    writeMemory(chip8, chip8->i, chip8->v[x] / 100);
+                    writeMemory(chip8, chip8->i + 1, (chip8->v[x] / 10) % 10);
+                    writeMemory(chip8, chip8->i + 2, chip8->v[x] % 10);
+                    break;
+                case 0x3A:
+                    /* set the audio pattern pitch to Vx */
+                    setAudioPitch(&chip8->sound, chip8->v[x]);
+                    chip8->specType = XOCHIP;
                     break;
                 case 0x55:
                     /* store V0 to Vx in memory starting at address I */
-                    for (int i = 0; i <= x; i++) {
-                        if (chip8->i + i < AMOUNT_MEMORY_BYTES)
-                            chip8->memory[chip8->i + i] = chip8->v[i];
-                    }
-                    if (chip8->specType == CHIP8)
+                    for (int i = 0; i <= x; i++)
+                        writeMemory(chip8, chip8->i + i, chip8->v[i]);
+                    if (chip8->specType != SCHIP)
                         chip8->i += x + 1;
                     break;
                 case 0x65:
@@ -678,16 +1045,16 @@ decodeAndExecuteOpcode(emulator *chip8, uint16_t opcode)
                         if (chip8->i + i < AMOUNT_MEMORY_BYTES)
                             chip8->v[i] = chip8->memory[chip8->i + i];
                     }
-                    if (chip8->specType == CHIP8)
+                    if (chip8->specType != SCHIP)
                         chip8->i += x + 1;
                     break;
                 case 0x75:
                     /* store V0 to Vx in the RPL user flags */
-                    chip8->specType = SCHIP;
+                    detectSchip(chip8);
                     break;
                 case 0x85:
                     /* fill V0 to Vx with values from the RPL user flags */
-                    chip8->specType = SCHIP;
+                    detectSchip(chip8);
                     break;
             }
     }
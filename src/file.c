@@ -3,11 +3,19 @@
 #include <SDL_log.h>
 #include <openssl/evp.h>
 
+#include "../include/emulator.h"
 #include "../include/file.h"
 
 #define SHA1_BLOCK_SIZE 20
 #define SHA1_STR_LEN    41
 
+/* platforms of the database whose interpreters wait for vertical blank, all on the COSMAC VIP */
+static const char *vblankPlatforms[] = {
+    "originalChip8",
+    "hybridVIP",
+    "chip8x",
+};
+
 static size_t
 writeMemoryCallback(void *contents, size_t size, size_t nmemb, void *userp)
 {
@@ -155,8 +163,40 @@ printRomInfo(cJSON *romInfo, cJSON *romHash)
     );
 }
 
+int
+getRomVblank(cJSON *romInfo, const char *hashString)
+{
+    const cJSON *rom        = cJSON_GetObjectItemCaseSensitive(
+        cJSON_GetObjectItemCaseSensitive(romInfo, "roms"),
+        hashString
+    );
+    const cJSON *platform   = cJSON_GetArrayItem(
+        cJSON_GetObjectItemCaseSensitive(rom, "platforms"),
+        0
+    );
+
+    if (!cJSON_IsString(platform) || platform->valuestring == NULL)
+        return VBLANK_AUTO;
+
+    /* the ROM may need the quirk set otherwise than its platform has it */
+    const cJSON *quirks = cJSON_GetObjectItemCaseSensitive(
+        cJSON_GetObjectItemCaseSensitive(rom, "quirkyPlatforms"),
+        platform->valuestring
+    );
+    const cJSON *vblank = cJSON_GetObjectItemCaseSensitive(quirks, "vblank");
+    if (cJSON_IsBool(vblank))
+        return cJSON_IsTrue(vblank) ? VBLANK_ON : VBLANK_OFF;
+
+    for (size_t i = 0; i < sizeof vblankPlatforms / sizeof *vblankPlatforms; i++) {
+        if (strcmp(platform->valuestring, vblankPlatforms[i]) == 0)
+            return VBLANK_ON;
+    }
+
+    return VBLANK_OFF;
+}
+
 SDL_bool
-isRomInDatabase(FILE *romFile)
+isRomInDatabase(FILE *romFile, int *vblank)
 {
     struct MemoryStruct hashChunk, infoChunk;
 
@@ -275,7 +315,6 @@ isRomInDatabase(FILE *romFile)
             "ROM hash found in database: %s\n",
             hashString
         );
-        free((void *)hashString);
     }
 
     /* pull the program info database */
@@ -290,6 +329,7 @@ isRomInDatabase(FILE *romFile)
             SDL_LOG_CATEGORY_APPLICATION,
             "failed to pull ROM info database\n"
         );
+        free((void *)hashString);
         free(hashChunk.memory);
         cJSON_Delete(hashJson);
         curl_easy_cleanup(curlHandle);
@@ -307,6 +347,7 @@ isRomInDatabase(FILE *romFile)
                 error_ptr
             );
         }
+        free((void *)hashString);
         free(hashChunk.memory);
         cJSON_Delete(hashJson);
         curl_easy_cleanup(curlHandle);
@@ -329,9 +370,11 @@ isRomInDatabase(FILE *romFile)
         );
     } else {
         printRomInfo(romInfo, romHash);
+        *vblank = getRomVblank(romInfo, hashString);
     }
 
     /* cleanup */
+    free((void *)hashString);
     free(hashChunk.memory);
     free(infoChunk.memory);
     cJSON_Delete(hashJson);
@@ -342,7 +385,7 @@ isRomInDatabase(FILE *romFile)
 }
 
 SDL_bool
-isRomValid(const char *romName, FILE *romFile, struct stat *st)
+isRomValid(const char *romName, FILE *romFile, struct stat *st, int *vblank)
 {
     /* check if file exists and is readable */
     if (romFile == NULL || fstat(fileno(romFile), st) == -1) {
@@ -354,7 +397,7 @@ isRomValid(const char *romName, FILE *romFile, struct stat *st)
         return SDL_FALSE;
     }
 
-    if (!isRomInDatabase(romFile)) {
+    if (!isRomInDatabase(romFile, vblank)) {
         SDL_LogError(
             SDL_LOG_CATEGORY_APPLICATION,
             "%s not found in database\n",
@@ -0,0 +1,309 @@
+#include <SDL.h>
+
+#include "../include/emulator.h"
+#include "../include/file.h"
+
+#define FUSIONGEN_CYCLES        2000000     // instructions executed per ROM
+#define FUSIONGEN_MAX_PAIRS     24          // pairs written to the table
+#define FUSIONGEN_MAX_TRIPLES   8           // triples written to the table
+#define FUSIONGEN_MIN_SHARE     0.002       // minimum share of all executed instructions
+#define FUSIONGEN_SEED          8           // fixed seed so the table is reproducible
+
+/* a counted run of adjacent instruction forms */
+typedef struct {
+    uint8_t     forms[FUSED_MAX_LENGTH];
+    uint64_t    count;
+} sequence;
+
+static const char *formNames[] = {
+#define X(form, handler) #form,
+    OPCODE_FORMS(X)
+#undef X
+};
+
+static uint64_t pairCounts[FORM_COUNT][FORM_COUNT];
+static uint64_t tripleCounts[FORM_COUNT][FORM_COUNT][FORM_COUNT];
+static uint64_t totalExecuted;
+
+/*
+ * Check whether an instruction may be followed by another one in a fused group.
+ * Groups must not continue past unconditional control transfers,
+ * stores that could overwrite the group, or the reference decoder.
+ */
+static SDL_bool
+canContinue(const uint8_t form)
+{
+    switch (form) {
+        case FORM_FALLBACK:
+        case FORM_00EE:
+        case FORM_1NNN:
+        case FORM_2NNN:
+        case FORM_BNNN:
+        case FORM_FX33:
+        case FORM_FX55:
+            return SDL_FALSE;
+    }
+
+    return SDL_TRUE;
+}
+
+/*
+ * Press or release a random key once per frame,
+ * so ROMs waiting for input make progress.
+ */
+static void
+pressRandomKey(display *display)
+{
+    clearKeys(display->keyUp);
+
+    if (randomNumber(0, 3) != 0)
+        return;
+
+    const int key = randomNumber(0, AMOUNT_KEYS - 1);
+    if (display->keyDown[key]) {
+        display->keyDown[key]   = SDL_FALSE;
+        display->keyUp[key]     = SDL_TRUE;
+    } else {
+        display->keyDown[key]   = SDL_TRUE;
+    }
+}
+
+/*
+ * Run a ROM headless and count the forms of adjacent instructions.
+ *
+ * Parameter:
+ * the path to the ROM
+ *
+ * Return:
+ * 0 on success,
+ * -1 on failure
+ */
+static int
+countRom(const char *path)
+{
+    static emulator chip8;
+    FILE            *rom = getRom(path);
+
+    if (rom == NULL) {
+        SDL_LogError(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "failed to open ROM file: %s\n",
+            path
+        );
+        return -1;
+    }
+
+    memset(&chip8, 0, sizeof chip8);
+    initializeEmulator(&chip8, rom);
+    fclose(rom);
+
+    chip8.dispatch          = DISPATCH_SWITCH;
+    chip8.vblankQuirk       = VBLANK_OFF;   // no display to wait on
+    chip8.display.poweredOn = SDL_TRUE;
+    setResolution(&chip8.display, CHIP8_WIDTH, CHIP8_HEIGHT);
+    resetDisplay(&chip8.display);
+
+    uint16_t    lastAddress = 0;
+    uint8_t     last[2]     = {FORM_FALLBACK, FORM_FALLBACK};
+    int         run         = 0;        // adjacent instructions ending at the last one
+
+    srand(FUSIONGEN_SEED);
+
+    for (int cycle = 0; cycle < FUSIONGEN_CYCLES && chip8.display.poweredOn; cycle++) {
+        if (cycle % (DEFAULT_IPS / 60) == 0) {
+            if (chip8.timers.delay > 0)
+                chip8.timers.delay--;
+            if (chip8.timers.sound > 0)
+                chip8.timers.sound--;
+            pressRandomKey(&chip8.display);
+        }
+
+        const uint16_t address = chip8.pc;
+        if (address >= AMOUNT_MEMORY_BYTES - 1)
+            break;
+
+        const uint16_t  opcode = fetchOpcode(&chip8);
+        instruction     ins;
+        decodeInstruction(&ins, opcode);
+
+        run = run > 0 && address == lastAddress + 2 ? run + 1 : 1;
+
+        if (ins.form != FORM_FALLBACK) {
+            if (run >= 2 && canContinue(last[1]))
+                pairCounts[last[1]][ins.form]++;
+            if (run >= 3 && canContinue(last[0]) && canContinue(last[1]))
+                tripleCounts[last[0]][last[1]][ins.form]++;
+        }
+
+        lastAddress = address;
+        last[0]     = last[1];
+        last[1]     = ins.form;
+
+        chip8.display.dirty     = SDL_FALSE;
+
+        chip8.pc += 2;
+        decodeAndExecuteOpcode(&chip8, opcode);
+        totalExecuted++;
+    }
+
+    return 0;
+}
+
+static int
+compareSequences(const void *a, const void *b)
+{
+    const sequence *left    = a;
+    const sequence *right   = b;
+
+    if (left->count != right->count)
+        return left->count < right->count ? 1 : -1;
+
+    return memcmp(left->forms, right->forms, sizeof left->forms);
+}
+
+/*
+ * Pick the most frequent sequences of a length.
+ *
+ * Parameters:
+ * the array to fill (FORM_COUNT^length entries),
+ * the sequence length, 2 or 3,
+ * the maximum number of sequences to keep
+ *
+ * Return:
+ * the number of sequences kept
+ */
+static int
+selectSequences(sequence *selected, const int length, const int limit)
+{
+    int found = 0;
+
+    for (int a = 0; a < FORM_COUNT; a++) {
+        for (int b = 0; b < FORM_COUNT; b++) {
+            for (int c = 0; c < (length == 3 ? FORM_COUNT : 1); c++) {
+                const uint64_t count = length == 3 ? tripleCounts[a][b][c] : pairCounts[a][b];
+                if (count == 0 || count < totalExecuted * FUSIONGEN_MIN_SHARE)
+                    continue;
+
+                selected[found].forms[0]    = a;
+                selected[found].forms[1]    = b;
+                selected[found].forms[2]    = c;
+                selected[found].count       = count;
+                found++;
+            }
+        }
+    }
+
+    qsort(selected, found, sizeof *selected, compareSequences);
+
+    return found < limit ? found : limit;
+}
+
+static void
+writeSequences(FILE *out, const char *name, const sequence *selected, const int amount, const int length)
+{
+    fprintf(out, "#define %s(X)%s\n", name, amount > 0 ? " \\" : "");
+
+    for (int s = 0; s < amount; s++) {
+        char entry[64];
+
+        if (length == 3) {
+            snprintf(
+                entry,
+                sizeof entry,
+                "X(%s, %s, %s)",
+                formNames[selected[s].forms[0]],
+                formNames[selected[s].forms[1]],
+                formNames[selected[s].forms[2]]
+            );
+        } else {
+            snprintf(
+                entry,
+                sizeof entry,
+                "X(%s, %s)",
+                formNames[selected[s].forms[0]],
+                formNames[selected[s].forms[1]]
+            );
+        }
+
+        fprintf(
+            out,
+            "    %-24s/* %5.2f%% */%s\n",
+            entry,
+            100.0 * selected[s].count / totalExecuted,
+            s + 1 < amount ? " \\" : ""
+        );
+    }
+
+    fprintf(out, "\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc < 3) {
+        SDL_LogError(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "usage:\t%s <output> <rom>...\n",
+            argv[0]
+        );
+        return -1;
+    }
+
+    int roms = 0;
+    for (int i = 2; i < argc; i++) {
+        if (countRom(argv[i]) == 0)
+            roms++;
+    }
+
+    if (totalExecuted == 0) {
+        SDL_LogError(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "no instructions executed\n"
+        );
+        return -1;
+    }
+
+    static sequence pairs[FORM_COUNT * FORM_COUNT];
+    static sequence triples[FORM_COUNT * FORM_COUNT * FORM_COUNT];
+    const int       amountPairs     = selectSequences(pairs, 2, FUSIONGEN_MAX_PAIRS);
+    const int       amountTriples   = selectSequences(triples, 3, FUSIONGEN_MAX_TRIPLES);
+
+    FILE *out = fopen(argv[1], "w");
+    if (out == NULL) {
+        SDL_LogError(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "failed to open %s for writing\n",
+            argv[1]
+        );
+        return -1;
+    }
+
+    fprintf(
+        out,
+        "#ifndef FUSION_H\n"
+        "#define FUSION_H\n"
+        "\n"
+        "/*\n"
+        " * Instruction sequences executed by fused handlers.\n"
+        " * Generated by fusiongen from %d ROMs (%llu instructions), do not edit;\n"
+        " * run `make fusion` to regenerate. Shares are of all executed instructions.\n"
+        " */\n"
+        "\n",
+        roms,
+        (unsigned long long)totalExecuted
+    );
+    writeSequences(out, "FUSED_PAIRS", pairs, amountPairs, 2);
+    writeSequences(out, "FUSED_TRIPLES", triples, amountTriples, 3);
+    fprintf(out, "#endif /* FUSION_H */\n");
+    fclose(out);
+
+    SDL_LogInfo(
+        SDL_LOG_CATEGORY_APPLICATION,
+        "wrote %d pairs and %d triples to %s\n",
+        amountPairs,
+        amountTriples,
+        argv[1]
+    );
+
+    return 0;
+}
@@ -0,0 +1,691 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "../include/emulator.h"
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+
+#include <sys/mman.h>
+
+#define JIT_BUFFER_SIZE     (4 * 1024 * 1024)
+#define JIT_MAX_BLOCKS      4096
+#define JIT_MAX_LINKS       16384
+#define JIT_MAX_BLOCK_LEN   64
+
+/* stores into translated code before an address is left to the interpreter */
+#define JIT_SMC_LIMIT       4
+
+/* worst case size of one translated instruction plus block epilogue */
+#define JIT_MAX_EMIT        128
+
+/* offsets into the emulator structure addressed from rbx */
+#define OFF_V(r)        ((int32_t)(offsetof(emulator, v) + (r)))
+#define OFF_I           ((int32_t)offsetof(emulator, i))
+#define OFF_PC          ((int32_t)offsetof(emulator, pc))
+#define OFF_DELAY       ((int32_t)offsetof(emulator, timers.delay))
+#define OFF_STACK       ((int32_t)offsetof(emulator, stack.s))
+#define OFF_SP          ((int32_t)offsetof(emulator, stack.sp))
+#define OFF_KEYDOWN     ((int32_t)offsetof(emulator, display.keyDown))
+
+/* x86-64 register numbers used in ModRM fields */
+#define REG_AL  0
+#define REG_CL  1
+#define REG_DL  2
+
+typedef int (*jitEnter)(emulator *chip8, int budget, const uint8_t *entry);
+
+typedef struct {
+    uint16_t    start;              // first translated address
+    uint32_t    end;                // one past the last byte the block depends on
+    uint32_t    entry;              // code offset of the block entry
+    uint32_t    bail;               // code offset of the budget bail-out
+    SDL_bool    valid;              // is the block still reachable?
+    SDL_bool    idle;               // does the block start at an idle loop?
+} jitBlock;
+
+typedef struct {
+    uint32_t    slot;               // code offset of the patchable jump
+    uint16_t    target;             // chip8 address the slot leads to
+} jitLink;
+
+struct jit {
+    uint8_t     *code;                          // executable buffer
+    size_t      used;                           // bytes emitted so far
+    size_t      exit;                           // code offset of the exit stub
+    jitEnter    enter;                          // entry trampoline
+    uint8_t     specType;                       // quirks blocks were built for
+    int32_t     entries[AMOUNT_MEMORY_BYTES];   // block index by address
+    uint8_t     covered[AMOUNT_MEMORY_BYTES];   // address inside some block?
+    uint8_t     stores[AMOUNT_MEMORY_BYTES];    // stores into translated code
+    jitBlock    blocks[JIT_MAX_BLOCKS];         // translated blocks
+    int         blockCount;                     // number of blocks
+    jitLink     links[JIT_MAX_LINKS];           // chainable block exits
+    int         linkCount;                      // number of links
+};
+
+static void
+emit8(jit *jit, const uint8_t byte)
+{
+    jit->code[jit->used++] = byte;
+}
+
+static void
+emit16(jit *jit, const uint16_t value)
+{
+    memcpy(&jit->code[jit->used], &value, sizeof value);
+    jit->used += sizeof value;
+}
+
+static void
+emit32(jit *jit, const uint32_t value)
+{
+    memcpy(&jit->code[jit->used], &value, sizeof value);
+    jit->used += sizeof value;
+}
+
+static void
+emit64(jit *jit, const uint64_t value)
+{
+    memcpy(&jit->code[jit->used], &value, sizeof value);
+    jit->used += sizeof value;
+}
+
+/* emit an opcode with a [rbx + disp32] memory operand */
+static void
+emitMem(jit *jit, const uint8_t op, const uint8_t reg, const int32_t disp)
+{
+    emit8(jit, op);
+    emit8(jit, 0x80 | (reg << 3) | 0x03);
+    emit32(jit, (uint32_t)disp);
+}
+
+/* point the rel32 operand at the given offset at a code offset */
+static void
+patchRel32(jit *jit, const size_t at, const size_t target)
+{
+    const int32_t rel = (int32_t)(target - (at + 4));
+    memcpy(&jit->code[at], &rel, sizeof rel);
+}
+
+static void
+emitJmp(jit *jit, const size_t target)
+{
+    emit8(jit, 0xE9);
+    emit32(jit, 0);
+    patchRel32(jit, jit->used - 4, target);
+}
+
+static void
+emitStorePc(jit *jit, const uint16_t pc)
+{
+    emit8(jit, 0x66);                       // mov word [rbx + pc], imm16
+    emitMem(jit, 0xC7, 0, OFF_PC);
+    emit16(jit, pc);
+}
+
+/* store the program counter and return to the dispatcher */
+static void
+emitExit(jit *jit, const uint16_t pc)
+{
+    emitStorePc(jit, pc);
+    emitJmp(jit, jit->exit);
+}
+
+/*
+ * Leave the block towards a chip8 address.
+ * The leading jump falls through to an exit until the target is
+ * translated, then it is patched to enter the target block directly.
+ */
+static void
+emitLink(jit *jit, const uint16_t target)
+{
+    if (jit->linkCount < JIT_MAX_LINKS) {
+        jit->links[jit->linkCount].slot     = jit->used + 1;
+        jit->links[jit->linkCount].target   = target;
+        jit->linkCount++;
+
+        emit8(jit, 0xE9);                   // jmp rel32, initially to next
+        emit32(jit, 0);
+    }
+    emitExit(jit, target);
+}
+
+/* run one instruction through the reference decoder */
+static void
+emitCall(jit *jit, const uint16_t next, const uint16_t opcode)
+{
+    emitStorePc(jit, next);
+    emit8(jit, 0x48);                       // mov rdi, rbx
+    emit8(jit, 0x89);
+    emit8(jit, 0xDF);
+    emit8(jit, 0xBE);                       // mov esi, opcode
+    emit32(jit, opcode);
+    emit8(jit, 0x48);                       // mov rax, decodeAndExecuteOpcode
+    emit8(jit, 0xB8);
+    emit64(jit, (uint64_t)(uintptr_t)decodeAndExecuteOpcode);
+    emit8(jit, 0xFF);                       // call rax
+    emit8(jit, 0xD0);
+}
+
+/* emit a two-way exit: skip the next skip bytes if the flags match jcc */
+static void
+emitSkip(jit *jit, const uint8_t jccSkip, const uint16_t addr, const uint16_t skip)
+{
+    emit8(jit, 0x0F);                       // jcc rel32 over the fallthrough
+    emit8(jit, jccSkip ^ 0x01);
+    emit32(jit, 0);
+    const size_t fixup = jit->used - 4;
+
+    emitLink(jit, addr + 2 + skip);
+    patchRel32(jit, fixup, jit->used);
+    emitLink(jit, addr + 2);
+}
+
+static void
+emitSetKeyFlags(jit *jit, const uint8_t x)
+{
+    emit8(jit, 0x0F);                       // movzx eax, byte Vx
+    emitMem(jit, 0xB6, REG_AL, OFF_V(x));
+    emit8(jit, 0x83);                       // cmp dword [rbx + rax*4 + keyDown], 0
+    emit8(jit, 0xBC);
+    emit8(jit, 0x83);
+    emit32(jit, (uint32_t)OFF_KEYDOWN);
+    emit8(jit, 0x00);
+}
+
+static void
+emitArithmetic(jit *jit, const uint8_t n, const uint8_t x, const uint8_t y, const uint8_t specType)
+{
+    switch (n) {
+        case 0x0:
+            emitMem(jit, 0x8A, REG_AL, OFF_V(y));   // mov al, Vy
+            emitMem(jit, 0x88, REG_AL, OFF_V(x));   // mov Vx, al
+            break;
+        case 0x1:
+        case 0x2:
+        case 0x3:
+            emitMem(jit, 0x8A, REG_AL, OFF_V(y));   // mov al, Vy
+            emitMem(                                // or/and/xor Vx, al
+                jit,
+                n == 0x1 ? 0x08 : n == 0x2 ? 0x20 : 0x30,
+                REG_AL,
+                OFF_V(x)
+            );
+            if (specType == CHIP8) {
+                emitMem(jit, 0xC6, 0, OFF_V(0xF));  // mov VF, 0
+                emit8(jit, 0x00);
+            }
+            break;
+        case 0x4:
+        case 0x5:
+        case 0x7:
+            emitMem(jit, 0x8A, REG_AL, OFF_V(n == 0x7 ? y : x));
+            emitMem(jit, 0x8A, REG_CL, OFF_V(n == 0x7 ? x : y));
+            emit8(jit, n == 0x4 ? 0x00 : 0x28);     // add/sub al, cl
+            emit8(jit, 0xC8);
+            emit8(jit, 0x0F);                       // setc/setnc dl
+            emit8(jit, n == 0x4 ? 0x92 : 0x93);
+            emit8(jit, 0xC2);
+            emitMem(jit, 0x88, REG_AL, OFF_V(x));   // mov Vx, al
+            emitMem(jit, 0x88, REG_DL, OFF_V(0xF)); // mov VF, dl
+            break;
+        case 0x6:
+        case 0xE:
+            emitMem(jit, 0x8A, REG_CL, OFF_V(x));   // mov cl, Vx
+            emitMem(jit, 0x8A, REG_AL, OFF_V(specType != SCHIP ? y : x));
+            emit8(jit, 0xD0);                       // shr/shl al, 1
+            emit8(jit, n == 0x6 ? 0xE8 : 0xE0);
+            if (n == 0x6) {
+                emit8(jit, 0x80);                   // and cl, 1
+                emit8(jit, 0xE1);
+                emit8(jit, 0x01);
+            } else {
+                emit8(jit, 0xC0);                   // shr cl, 7
+                emit8(jit, 0xE9);
+                emit8(jit, 0x07);
+            }
+            emitMem(jit, 0x88, REG_AL, OFF_V(x));   // mov Vx, al
+            emitMem(jit, 0x88, REG_CL, OFF_V(0xF)); // mov VF, cl
+            break;
+    }
+}
+
+/*
+ * Translate one instruction.
+ * A taken skip jumps over skip bytes, as decided by the spec
+ * and the instruction that follows.
+ *
+ * Return:
+ * SDL_TRUE if the instruction ends the block
+ */
+static SDL_bool
+emitInstruction(
+    jit *jit,
+    const uint16_t addr,
+    const uint16_t opcode,
+    const uint8_t specType,
+    const uint16_t skip
+)
+{
+    const uint8_t   x   = (opcode & 0x0F00) >> 8;
+    const uint8_t   y   = (opcode & 0x00F0) >> 4;
+    const uint8_t   n   = opcode & 0x000F;
+    const uint8_t   nn  = opcode & 0x00FF;
+    const uint16_t  nnn = opcode & 0x0FFF;
+
+    switch (opcode >> 12) {
+        case 0x1:
+            emitLink(jit, nnn);
+            return SDL_TRUE;
+        case 0x2:
+            emit8(jit, 0x0F);                       // movzx eax, byte sp
+            emitMem(jit, 0xB6, REG_AL, OFF_SP);
+            emit8(jit, 0x3C);                       // cmp al, STACK_LEVELS
+            emit8(jit, STACK_LEVELS);
+            emit8(jit, 0x73);                       // jae over the push
+            emit8(jit, 0);
+            const size_t overflow = jit->used;
+            emit8(jit, 0x66);                       // mov word [rbx + rax*2 + s], ret
+            emit8(jit, 0xC7);
+            emit8(jit, 0x84);
+            emit8(jit, 0x43);
+            emit32(jit, (uint32_t)OFF_STACK);
+            emit16(jit, addr + 2);
+            emitMem(jit, 0xFE, 0, OFF_SP);          // inc byte sp
+            jit->code[overflow - 1] = jit->used - overflow;
+            emitLink(jit, nnn);
+            return SDL_TRUE;
+        case 0x3:
+        case 0x4:
+            emitMem(jit, 0x80, 7, OFF_V(x));        // cmp Vx, nn
+            emit8(jit, nn);
+            emitSkip(jit, opcode >> 12 == 0x3 ? 0x84 : 0x85, addr, skip);
+            return SDL_TRUE;
+        case 0x5:
+        case 0x9:
+            if (n != 0)
+                break;                              // XO-CHIP ranged save and load
+            emitMem(jit, 0x8A, REG_AL, OFF_V(x));   // mov al, Vx
+            emitMem(jit, 0x3A, REG_AL, OFF_V(y));   // cmp al, Vy
+            emitSkip(jit, opcode >> 12 == 0x5 ? 0x84 : 0x85, addr, skip);
+            return SDL_TRUE;
+        case 0x6:
+            emitMem(jit, 0xC6, 0, OFF_V(x));        // mov Vx, nn
+            emit8(jit, nn);
+            return SDL_FALSE;
+        case 0x7:
+            emitMem(jit, 0x80, 0, OFF_V(x));        // add Vx, nn
+            emit8(jit, nn);
+            return SDL_FALSE;
+        case 0x8:
+            if (n <= 0x7 || n == 0xE) {
+                emitArithmetic(jit, n, x, y, specType);
+                return SDL_FALSE;
+            }
+            return SDL_FALSE;                       // no-op in the reference
+        case 0xA:
+            emit8(jit, 0x66);                       // mov word I, nnn
+            emitMem(jit, 0xC7, 0, OFF_I);
+            emit16(jit, nnn);
+            return SDL_FALSE;
+        case 0xC:
+            emitCall(jit, addr + 2, opcode);
+            return SDL_FALSE;
+        case 0xE:
+            if (nn == 0x9E || nn == 0xA1) {
+                emitSetKeyFlags(jit, x);
+                emitSkip(jit, nn == 0x9E ? 0x85 : 0x84, addr, skip);
+                return SDL_TRUE;
+            }
+            return SDL_FALSE;                       // no-op in the reference
+        case 0xF:
+            switch (nn) {
+                case 0x07:
+                    emitMem(jit, 0x8A, REG_AL, OFF_DELAY);
+                    emitMem(jit, 0x88, REG_AL, OFF_V(x));
+                    return SDL_FALSE;
+                case 0x15:
+                    emitMem(jit, 0x8A, REG_AL, OFF_V(x));
+                    emitMem(jit, 0x88, REG_AL, OFF_DELAY);
+                    return SDL_FALSE;
+                case 0x1E:
+                    emit8(jit, 0x0F);               // movzx eax, byte Vx
+                    emitMem(jit, 0xB6, REG_AL, OFF_V(x));
+                    emit8(jit, 0x66);               // add word I, ax
+                    emitMem(jit, 0x01, REG_AL, OFF_I);
+                    return SDL_FALSE;
+                case 0x29:
+                    emit8(jit, 0x0F);               // movzx eax, byte Vx
+                    emitMem(jit, 0xB6, REG_AL, OFF_V(x));
+                    emit8(jit, 0x83);               // and eax, 0xF
+                    emit8(jit, 0xE0);
+                    emit8(jit, 0x0F);
+                    emit8(jit, 0x8D);               // lea eax, [rax + rax*4]
+                    emit8(jit, 0x04);
+                    emit8(jit, 0x80);
+                    emit8(jit, 0x66);               // mov word I, ax
+                    emitMem(jit, 0x89, REG_AL, OFF_I);
+                    return SDL_FALSE;
+                case 0x65:
+                    emitCall(jit, addr + 2, opcode);
+                    return SDL_FALSE;
+            }
+            break;
+    }
+
+    /*
+     * drawing, key waits, sound, returns, computed jumps, stores and
+     * mode switches run through the reference decoder and end the block
+     */
+    emitCall(jit, addr + 2, opcode);
+    emitJmp(jit, jit->exit);
+    return SDL_TRUE;
+}
+
+static void
+linkBlock(jit *jit, const int index)
+{
+    const jitBlock *block = &jit->blocks[index];
+
+    /* idle loops are only entered from the dispatcher, which checks them first */
+    for (int i = 0; i < jit->linkCount; i++) {
+        if (jit->links[i].target == block->start) {
+            if (!block->idle)
+                patchRel32(jit, jit->links[i].slot, block->entry);
+        } else if (
+            jit->links[i].slot > block->entry
+            &&
+            jit->links[i].slot < jit->used
+            &&
+            jit->entries[jit->links[i].target] >= 0
+            &&
+            !jit->blocks[jit->entries[jit->links[i].target]].idle
+        )
+            patchRel32(
+                jit,
+                jit->links[i].slot,
+                jit->blocks[jit->entries[jit->links[i].target]].entry
+            );
+    }
+}
+
+/* is the instruction at an address rewritten too often to translate? */
+static SDL_bool
+isVolatile(const jit *jit, const uint16_t addr)
+{
+    return jit->stores[addr] >= JIT_SMC_LIMIT || jit->stores[addr + 1] >= JIT_SMC_LIMIT;
+}
+
+/*
+ * Translate the basic block starting at an address.
+ *
+ * Return:
+ * the block index,
+ * -1 if the code buffer or block table is full
+ */
+static int
+compileBlock(jit *jit, const emulator *chip8, const uint16_t start)
+{
+    if (
+        jit->blockCount >= JIT_MAX_BLOCKS
+        ||
+        jit->used + JIT_MAX_BLOCK_LEN * JIT_MAX_EMIT > JIT_BUFFER_SIZE
+    )
+        return -1;
+
+    jitBlock    *block  = &jit->blocks[jit->blockCount];
+    uint32_t    addr    = start;                // may run one past the end of memory
+    uint32_t    count   = 0;
+    uint16_t    opcode  = 0;
+    SDL_bool    ended   = SDL_FALSE;
+
+    block->start    = start;
+    block->entry    = jit->used;
+    block->valid    = SDL_TRUE;
+    block->idle     = isIdleLoop(chip8, start);
+
+    /* bail out to the dispatcher when the budget cannot cover the block */
+    emit8(jit, 0x41);                       // cmp r12d, count
+    emit8(jit, 0x81);
+    emit8(jit, 0xFC);
+    emit32(jit, 0);
+    const size_t countCheck = jit->used - 4;
+    emit8(jit, 0x0F);                       // jl bail
+    emit8(jit, 0x8C);
+    emit32(jit, 0);
+    const size_t bailFixup = jit->used - 4;
+    emit8(jit, 0x41);                       // sub r12d, count
+    emit8(jit, 0x81);
+    emit8(jit, 0xEC);
+    emit32(jit, 0);
+    const size_t countSub = jit->used - 4;
+
+    while (
+        !ended
+        &&
+        count < JIT_MAX_BLOCK_LEN
+        &&
+        addr < AMOUNT_MEMORY_BYTES - 1
+        &&
+        !isVolatile(jit, addr)
+        &&
+        (count == 0 || !isIdleLoop(chip8, addr))
+    ) {
+        opcode  = (chip8->memory[addr] << 8) | chip8->memory[addr + 1];
+        ended   = emitInstruction(
+            jit,
+            addr,
+            opcode,
+            chip8->specType,
+            getSkipLength(chip8, addr + 2)
+        );
+        addr += 2;
+        count++;
+    }
+
+    if (!ended)
+        emitLink(jit, addr);
+
+    block->bail = jit->used;
+    emitExit(jit, start);
+
+    memcpy(&jit->code[countCheck], &count, sizeof count);
+    memcpy(&jit->code[countSub], &count, sizeof count);
+    patchRel32(jit, bailFixup, block->bail);
+
+    block->end = addr < AMOUNT_MEMORY_BYTES ? addr : AMOUNT_MEMORY_BYTES;
+
+    /* where a final skip lands depends on the instruction it skips */
+    if (ended && isSkip(opcode))
+        block->end = SDL_min(block->end + 2, AMOUNT_MEMORY_BYTES);
+    for (uint32_t a = start; a < block->end; a++)
+        jit->covered[a] = 1;
+
+    jit->entries[start] = jit->blockCount;
+    linkBlock(jit, jit->blockCount);
+
+    return jit->blockCount++;
+}
+
+static void
+resetJit(jit *jit)
+{
+    static const uint8_t trampoline[] = {
+        0x53,                       // push rbx
+        0x41, 0x54,                 // push r12
+        0x41, 0x55,                 // push r13 (keeps the stack aligned)
+        0x48, 0x89, 0xFB,           // mov rbx, rdi
+        0x41, 0x89, 0xF4,           // mov r12d, esi
+        0xFF, 0xE2,                 // jmp rdx
+        0x44, 0x89, 0xE0,           // exit: mov eax, r12d
+        0x41, 0x5D,                 // pop r13
+        0x41, 0x5C,                 // pop r12
+        0x5B,                       // pop rbx
+        0xC3                        // ret
+    };
+
+    memcpy(jit->code, trampoline, sizeof trampoline);
+    jit->enter      = (jitEnter)(void *)jit->code;
+    jit->exit       = 13;
+    jit->used       = sizeof trampoline;
+    jit->blockCount = 0;
+    jit->linkCount  = 0;
+
+    memset(jit->entries, 0xFF, sizeof jit->entries);
+    memset(jit->covered, 0, sizeof jit->covered);
+}
+
+jit *
+createJit(void)
+{
+    jit *jit = malloc(sizeof *jit);
+    if (jit == NULL) {
+        SDL_LogError(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "failed to allocate memory for the recompiler\n"
+        );
+        return NULL;
+    }
+
+    jit->code = mmap(
+        NULL,
+        JIT_BUFFER_SIZE,
+        PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0
+    );
+    if (jit->code == MAP_FAILED) {
+        SDL_LogError(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "failed to map executable memory for the recompiler\n"
+        );
+        free(jit);
+        return NULL;
+    }
+
+    jit->specType = 0;
+    flushJit(jit);
+
+    return jit;
+}
+
+void
+destroyJit(jit *jit)
+{
+    if (jit == NULL)
+        return;
+
+    munmap(jit->code, JIT_BUFFER_SIZE);
+    free(jit);
+}
+
+void
+flushJit(jit *jit)
+{
+    resetJit(jit);
+    memset(jit->stores, 0, sizeof jit->stores);
+}
+
+void
+invalidateJit(jit *jit, const uint16_t address)
+{
+    if (address >= AMOUNT_MEMORY_BYTES || !jit->covered[address])
+        return;
+
+    if (jit->stores[address] < JIT_SMC_LIMIT)
+        jit->stores[address]++;
+
+    for (int i = 0; i < jit->blockCount; i++) {
+        jitBlock *block = &jit->blocks[i];
+        if (!block->valid || address < block->start || address >= block->end)
+            continue;
+
+        /* send anything still entering the block to its bail-out */
+        jit->code[block->entry] = 0xE9;
+        patchRel32(jit, block->entry + 1, block->bail);
+
+        block->valid = SDL_FALSE;
+        if (jit->entries[block->start] == i)
+            jit->entries[block->start] = -1;
+    }
+}
+
+int
+runJit(emulator *chip8, const int budget)
+{
+    jit *jit        = chip8->jit;
+    int remaining   = budget;
+
+    while (remaining > 0) {
+        if (isIdle(chip8))
+            break;
+
+        /* blocks bake in the quirks and skips of the current spec */
+        if (jit->specType != chip8->specType) {
+            resetJit(jit);
+            jit->specType = chip8->specType;
+        }
+
+        /* self-modifying code is left to the interpreter */
+        if (chip8->pc >= AMOUNT_MEMORY_BYTES - 1 || isVolatile(jit, chip8->pc)) {
+            remaining -= runThreaded(chip8, 1);
+            if (hostNeeded(chip8))
+                break;
+            continue;
+        }
+
+        int index = jit->entries[chip8->pc];
+        if (index < 0) {
+            index = compileBlock(jit, chip8, chip8->pc);
+            if (index < 0) {
+                flushJit(jit);
+                index = compileBlock(jit, chip8, chip8->pc);
+            }
+        }
+
+        const int left = jit->enter(chip8, remaining, &jit->code[jit->blocks[index].entry]);
+        if (left == remaining) {
+            /* the block is longer than the budget left, so interpret the rest */
+            remaining -= runThreaded(chip8, remaining);
+            break;
+        }
+        remaining = left;
+
+        if (hostNeeded(chip8))
+            break;
+    }
+
+    return budget - remaining;
+}
+
+#else
+
+jit *
+createJit(void)
+{
+    return NULL;
+}
+
+void
+destroyJit(jit *jit)
+{
+}
+
+void
+flushJit(jit *jit)
+{
+}
+
+void
+invalidateJit(jit *jit, const uint16_t address)
+{
+}
+
+int
+runJit(emulator *chip8, const int budget)
+{
+    return runThreaded(chip8, budget);
+}
+
+#endif
@@ -0,0 +1,79 @@
+#include <errno.h>
+#include <time.h>
+
+#include "../include/pacing.h"
+
+uint64_t
+getMonotonicTime(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * NS_PER_SECOND + now.tv_nsec;
+}
+
+void
+sleepUntil(const uint64_t deadline)
+{
+
+#if defined(__linux__)
+
+    const struct timespec wake = {
+        .tv_sec     = deadline / NS_PER_SECOND,
+        .tv_nsec    = deadline % NS_PER_SECOND
+    };
+
+    /* absolute deadline, so an interrupted sleep simply resumes */
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR)
+        ;
+
+#else
+
+    /* no absolute sleep (macOS), so sleep for what is left until it passes */
+    uint64_t now = getMonotonicTime();
+    while (now < deadline) {
+        const struct timespec remaining = {
+            .tv_sec     = (deadline - now) / NS_PER_SECOND,
+            .tv_nsec    = (deadline - now) % NS_PER_SECOND
+        };
+        nanosleep(&remaining, NULL);
+        now = getMonotonicTime();
+    }
+
+#endif
+
+}
+
+void
+startPacer(pacer *pacer, const uint32_t rate)
+{
+    pacer->origin   = getMonotonicTime();
+    pacer->frame    = 0;
+    pacer->rate     = rate;
+}
+
+uint64_t
+getTimeToFrame(const pacer *pacer)
+{
+    const uint64_t  deadline    = pacer->origin + pacer->frame * NS_PER_SECOND / pacer->rate;
+    const uint64_t  now         = getMonotonicTime();
+
+    return now < deadline ? deadline - now : 0;
+}
+
+void
+waitForFrame(pacer *pacer)
+{
+    const uint64_t  deadline    = pacer->origin + pacer->frame * NS_PER_SECOND / pacer->rate;
+    const uint64_t  now         = getMonotonicTime();
+
+    if (now > deadline + PACER_MAX_LATE * NS_PER_SECOND / pacer->rate) {
+        /* too far behind to catch up, start over from now */
+        pacer->origin   = now;
+        pacer->frame    = 1;
+        return;
+    }
+
+    sleepUntil(deadline);
+    pacer->frame++;
+}
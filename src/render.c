@@ -0,0 +1,242 @@
+#include <SDL.h>
+
+#include "../include/render.h"
+
+#define BLACK_PIXEL_COLOR       0, 0, 0, 255
+
+#define BLACK_TEXEL             0xFF000000  // ARGB8888
+#define WHITE_TEXEL             0xFFFFFFFF  // ARGB8888
+#define LIGHT_TEXEL             0xFFAAAAAA  // ARGB8888
+#define DARK_TEXEL              0xFF555555  // ARGB8888
+
+/* texel for each pixel color, a pixel set only in the first plane is white */
+static const Uint32 palette[1 << DISPLAY_PLANES] = {
+    BLACK_TEXEL,
+    WHITE_TEXEL,
+    LIGHT_TEXEL,
+    DARK_TEXEL
+};
+
+/*
+ * Upload the dirty rows of a frame to the texture and present it.
+ * Runs of adjacent dirty rows are converted and uploaded as one sub-rectangle.
+ * The texture is sized for hi-res, lo-res frames use its top left quarter.
+ */
+static int
+drawFrame(presenter *presenter, const frame *frame)
+{
+    const SDL_Rect  source  = {0, 0, frame->pixelWidth, frame->pixelHeight};
+    const uint64_t  rows    = frame->rows;
+
+    for (int y = 0; y < frame->pixelHeight;) {
+        if (!((rows >> y) & 1)) {
+            y++;
+            continue;
+        }
+
+        int end = y;
+        for (; end < frame->pixelHeight && ((rows >> end) & 1); end++) {
+            Uint32 *row = &presenter->texels[end * frame->pixelWidth];
+            for (int x = 0; x < frame->pixelWidth; x++)
+                row[x] = palette[PIXEL_COLOR(frame->framebuffer[end], x)];
+        }
+
+        const SDL_Rect band = {0, y, frame->pixelWidth, end - y};
+        if (
+            SDL_UpdateTexture(
+                presenter->texture,
+                &band,
+                &presenter->texels[y * frame->pixelWidth],
+                frame->pixelWidth * sizeof *presenter->texels
+            ) != 0
+        )
+            return -1;
+
+        y = end;
+    }
+
+    if (
+        SDL_SetRenderDrawColor(presenter->renderer, BLACK_PIXEL_COLOR) != 0
+        ||
+        SDL_RenderClear(presenter->renderer) != 0
+        ||
+        SDL_RenderCopy(presenter->renderer, presenter->texture, &source, NULL) != 0
+    )
+        return -1;
+
+    SDL_RenderPresent(presenter->renderer);
+
+    return 0;
+}
+
+int
+getPresentPolicy(const char *name)
+{
+    if (strcmp(name, "vsync") == 0)
+        return PRESENT_VSYNC;
+    if (strcmp(name, "fixed") == 0)
+        return PRESENT_FIXED;
+    if (strcmp(name, "last") == 0)
+        return PRESENT_LAST_DRAW;
+
+    return 0;
+}
+
+int
+startPresenter(presenter *presenter, SDL_Window *window, const int policy)
+{
+    presenter->window       = window;
+    presenter->policy       = policy;
+    presenter->back         = 0;
+    presenter->front        = 1;
+    presenter->unseenRows   = 0;
+
+    atomic_store(&presenter->shared, 2);
+
+    presenter->wakeEvent = SDL_RegisterEvents(1);
+    if (presenter->wakeEvent == (Uint32)-1) {
+        SDL_LogError(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "failed to register wake event: %s\n",
+            SDL_GetError()
+        );
+        return -1;
+    }
+
+    /* keep pixels sharp when the texture is scaled up */
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+
+    /* vsync makes every present wait for the host refresh */
+    presenter->renderer = SDL_CreateRenderer(
+        window,
+        -1,
+        SDL_RENDERER_ACCELERATED
+        |
+        (policy == PRESENT_FIXED ? 0 : SDL_RENDERER_PRESENTVSYNC)
+    );
+    if (presenter->renderer == NULL) {
+        SDL_LogError(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "failed to create renderer: %s\n",
+            SDL_GetError()
+        );
+        return -1;
+    }
+
+    /* one canvas for both resolutions, scaled to the window whatever its size */
+    presenter->texture = SDL_CreateTexture(
+        presenter->renderer,
+        SDL_PIXELFORMAT_ARGB8888,
+        SDL_TEXTUREACCESS_STREAMING,
+        SCHIP_WIDTH,
+        SCHIP_HEIGHT
+    );
+    if (
+        presenter->texture == NULL
+        ||
+        SDL_RenderSetLogicalSize(presenter->renderer, SCHIP_WIDTH, SCHIP_HEIGHT) != 0
+    ) {
+        SDL_LogError(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "failed to create canvas: %s\n",
+            SDL_GetError()
+        );
+        if (presenter->texture != NULL)
+            SDL_DestroyTexture(presenter->texture);
+        SDL_DestroyRenderer(presenter->renderer);
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+publishFrame(presenter *presenter, display *display)
+{
+    frame       *back = &presenter->frames[presenter->back];
+    uint64_t    rows;
+
+    if (presenter->policy == PRESENT_LAST_DRAW) {
+        /* changes after the last draw wait for the next one */
+        if (!display->drawn)
+            return;
+        memcpy(back->framebuffer, display->drawnFramebuffer, sizeof back->framebuffer);
+        rows = display->drawnRows;
+    } else {
+        if (!display->dirty)
+            return;
+        memcpy(back->framebuffer, display->framebuffer, sizeof back->framebuffer);
+        rows = display->drawnRows | display->dirtyRows;
+        display->dirtyRows = 0;
+    }
+    display->dirty      = SDL_FALSE;
+    display->drawn      = SDL_FALSE;
+    display->drawnRows  = 0;
+
+    /* the frame carries every row the main thread has not seen change */
+    presenter->unseenRows   |= rows;
+    back->rows              = presenter->unseenRows;
+    back->pixelWidth        = display->pixelWidth;
+    back->pixelHeight       = display->pixelHeight;
+
+    /*
+     * swap the written buffer in and take back whichever one was waiting,
+     * releasing the writes above and acquiring the buffer's last reads
+     */
+    const int previous      = atomic_exchange_explicit(
+        &presenter->shared,
+        presenter->back | RENDER_FRESH,
+        memory_order_acq_rel
+    );
+    presenter->back         = previous & ~RENDER_FRESH;
+
+    /*
+     * a frame left waiting was replaced, so its rows stay unseen;
+     * otherwise the main thread took the previous frame,
+     * after which only the rows of this one changed
+     */
+    if (!(previous & RENDER_FRESH))
+        presenter->unseenRows = rows;
+
+    /* one wake-up is enough until the main thread took the frame */
+    if (presenter->policy != PRESENT_FIXED && !(previous & RENDER_FRESH)) {
+        SDL_Event wake = {0};
+        wake.type = presenter->wakeEvent;
+        SDL_PushEvent(&wake);
+    }
+}
+
+int
+presentFrame(presenter *presenter)
+{
+    if (!(atomic_load_explicit(&presenter->shared, memory_order_relaxed) & RENDER_FRESH))
+        return 0;
+
+    /*
+     * take the latest frame, leaving the one just shown for the emulator to reuse,
+     * acquiring the emulator's writes to it and releasing the reads of the other
+     */
+    presenter->front = atomic_exchange_explicit(
+        &presenter->shared,
+        presenter->front,
+        memory_order_acq_rel
+    ) & ~RENDER_FRESH;
+
+    if (drawFrame(presenter, &presenter->frames[presenter->front]) != 0) {
+        SDL_LogError(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "error drawing frame: %s\n",
+            SDL_GetError()
+        );
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+stopPresenter(presenter *presenter)
+{
+    SDL_DestroyTexture(presenter->texture);
+    SDL_DestroyRenderer(presenter->renderer);
+}
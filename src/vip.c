@@ -0,0 +1,117 @@
+#include "../include/emulator.h"
+#include "../include/vip.h"
+
+/*
+ * Machine cycles of the VIP interpreter, one machine cycle being
+ * 8 clocks of the 1.76 MHz CDP1802, as measured from its ROM listing.
+ */
+#define VIP_FETCH_CYCLES    68          // fetching and decoding any instruction
+#define VIP_CLEAR_CYCLES    3102        // clearing the 256-byte display page
+#define VIP_SPRITE_CYCLES   26          // setting up a sprite
+#define VIP_ROW_CYCLES      46          // drawing a sprite byte into the display
+#define VIP_SHIFT_CYCLES    20          // more per row when the row straddles two bytes
+
+/*
+ * Get the machine cycles an instruction takes on the VIP,
+ * decided by the state before it executes.
+ *
+ * Parameters:
+ * the emulator,
+ * the instruction
+ *
+ * Return:
+ * the number of machine cycles
+ */
+static int
+getVipCycles(const emulator *chip8, const uint16_t opcode)
+{
+    const uint8_t   x   = (opcode & 0x0F00) >> 8;
+    const uint8_t   y   = (opcode & 0x00F0) >> 4;
+    const uint8_t   n   = opcode & 0x000F;
+    const uint8_t   nn  = opcode & 0x00FF;
+    const uint16_t  nnn = opcode & 0x0FFF;
+    const uint8_t   vx  = chip8->v[x];
+
+    switch (opcode >> 12) {
+        case 0x0:
+            if (opcode == 0x00E0)
+                return VIP_FETCH_CYCLES + VIP_CLEAR_CYCLES;
+            return VIP_FETCH_CYCLES + 10;
+        case 0x1:
+            return VIP_FETCH_CYCLES + 12;
+        case 0x2:
+            return VIP_FETCH_CYCLES + 26;
+        case 0x3:
+            return VIP_FETCH_CYCLES + (vx == nn ? 14 : 10);
+        case 0x4:
+            return VIP_FETCH_CYCLES + (vx != nn ? 14 : 10);
+        case 0x5:
+            return VIP_FETCH_CYCLES + (vx == chip8->v[y] ? 18 : 14);
+        case 0x6:
+            return VIP_FETCH_CYCLES + 6;
+        case 0x7:
+            return VIP_FETCH_CYCLES + 10;
+        case 0x8:
+            return VIP_FETCH_CYCLES + (n == 0x0 ? 12 : 44);
+        case 0x9:
+            return VIP_FETCH_CYCLES + (vx != chip8->v[y] ? 18 : 14);
+        case 0xA:
+            return VIP_FETCH_CYCLES + 12;
+        case 0xB:
+            /* one more branch when the jump crosses a page */
+            return VIP_FETCH_CYCLES + ((nnn + chip8->v[0]) >> 8 != nnn >> 8 ? 24 : 22);
+        case 0xC:
+            return VIP_FETCH_CYCLES + 36;
+        case 0xD: {
+            /* the rows of a sprite off a byte boundary are shifted into two display bytes */
+            const int rowCycles = VIP_ROW_CYCLES + ((vx & 0x7) != 0 ? VIP_SHIFT_CYCLES : 0);
+            /* as drawn: a 16x16 sprite for N = 0, one sprite per selected plane */
+            const int bytes     = getSpriteRows(chip8, n) * (n == 0 ? 2 : 1) * getSpritePlanes(chip8);
+            return VIP_FETCH_CYCLES + VIP_SPRITE_CYCLES + bytes * rowCycles;
+        }
+        case 0xE:
+            if (nn == 0x9E)
+                return VIP_FETCH_CYCLES + (chip8->display.keyDown[vx & 0xF] ? 18 : 14);
+            if (nn == 0xA1)
+                return VIP_FETCH_CYCLES + (!chip8->display.keyDown[vx & 0xF] ? 18 : 14);
+            return VIP_FETCH_CYCLES;
+        case 0xF:
+            switch (nn) {
+                case 0x1E:
+                case 0x29:
+                    return VIP_FETCH_CYCLES + 16;
+                case 0x33:
+                    /* a loop of subtractions for every unit of every digit */
+                    return VIP_FETCH_CYCLES + 80 + 16 * (vx / 100 + vx / 10 % 10 + vx % 10);
+                case 0x55:
+                case 0x65:
+                    return VIP_FETCH_CYCLES + 14 + 14 * x;
+            }
+            return VIP_FETCH_CYCLES + 10;
+    }
+
+    return VIP_FETCH_CYCLES;
+}
+
+int
+runVip(emulator *chip8, const int budget)
+{
+    int spent = 0;
+
+    while (spent < budget && !isIdle(chip8)) {
+        const uint16_t  opcode  = fetchOpcode(chip8);
+        const int       cycles  = getVipCycles(chip8, opcode);
+
+        chip8->pc += 2;
+        decodeAndExecuteOpcode(chip8, opcode);
+
+        /* a sprite or key wait is charged once it is over, in a later frame */
+        if (chip8->state == STATE_RUNNING)
+            spent += cycles;
+
+        if (hostNeeded(chip8))
+            break;
+    }
+
+    return spent;
+}